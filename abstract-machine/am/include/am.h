@@ -11,6 +11,7 @@
 #define MMAP_NONE  0x00000000 // no access
 #define MMAP_READ  0x00000001 // can read
 #define MMAP_WRITE 0x00000002 // can write
+#define MMAP_EXEC  0x00000004 // can execute, not implied by MMAP_READ
 
 // Memory area for [@start, @end)
 typedef struct {
@@ -59,6 +60,12 @@ bool     cte_init    (Context *(*handler)(Event ev, Context *ctx));
 void     yield       (void);
 bool     ienabled    (void);
 void     iset        (bool enable);
+void     cte_set_tick(uint64_t us);
+void     sleep_until (uint64_t us);
+void     cte_irq_enable (int irq, int priority);
+void     cte_irq_disable(int irq);
+void     cte_syscall_table(uintptr_t (* const *table)(uintptr_t, uintptr_t, uintptr_t,
+                           uintptr_t, uintptr_t, uintptr_t), int nr);
 Context *kcontext    (Area kstack, void (*entry)(void *), void *arg);
 
 // ----------------------- VME: Virtual Memory -----------------------
@@ -68,6 +75,14 @@ void     unprotect   (AddrSpace *as);
 void     map         (AddrSpace *as, void *vaddr, void *paddr, int prot);
 Context *ucontext    (AddrSpace *as, Area kstack, void *entry);
 
+// ---------------------- MPE: Multi-Processing ----------------------
+bool     mpe_init    (void (*entry)());
+int      cpu_count   (void);
+int      cpu_current (void);
+int      atomic_xchg (int *addr, int newval);
+void     cpu_idle    (void);
+void     cpu_wake    (int cpu);
+
 #ifdef __cplusplus
 }
 #endif
@@ -30,12 +30,16 @@ AM_DEVREG(15, AUDIO_CTRL,   WR, int freq, channels, samples);
 AM_DEVREG(16, AUDIO_STATUS, RD, int count);
 AM_DEVREG(17, AUDIO_PLAY,   WR, Area buf);
 AM_DEVREG(18, DISK_CONFIG,  RD, bool present; int blksz, blkcnt);
-AM_DEVREG(19, DISK_STATUS,  RD, bool ready);
+AM_DEVREG(19, DISK_STATUS,  RD, bool ready; int inflight);
 AM_DEVREG(20, DISK_BLKIO,   WR, bool write; void *buf; int blkno, blkcnt);
 AM_DEVREG(21, NET_CONFIG,   RD, bool present);
 AM_DEVREG(22, NET_STATUS,   RD, int rx_len, tx_len);
 AM_DEVREG(23, NET_TX,       WR, Area buf);
 AM_DEVREG(24, NET_RX,       WR, Area buf);
+AM_DEVREG(25, DISK_FLUSH,   WR, bool invalidate);
+AM_DEVREG(26, DISK_SUBMIT,  WR, bool write; void *buf; int blkno, blkcnt; uintptr_t tag);
+AM_DEVREG(27, TIMER_CYCLES, RD, uint64_t cycles);
+AM_DEVREG(28, DISK_REAP,    RD, bool done; uintptr_t tag);
 
 // ================================================================
 // keyboard
@@ -13,10 +13,10 @@ struct Context {
 
 #define GPR1 gpr[17] // a7
 
-#define GPR2 gpr[0]
-#define GPR3 gpr[0]
-#define GPR4 gpr[0]
-#define GPRx gpr[0]
+#define GPR2 gpr[10] // a0
+#define GPR3 gpr[11] // a1
+#define GPR4 gpr[12] // a2
+#define GPRx gpr[10] // a0
 
 #define MVENDORID                                                              \
   ({                                                                           \
@@ -0,0 +1,102 @@
+#include <am.h>
+#include <npc.h>
+
+// CLINT timer. mtimecmp serves two clients: the periodic tick delivered
+// as EVENT_IRQ_TIMER, which only hart 0 takes, and sleep_until(), which
+// parks the calling hart in wfi until its deadline so a simulator can
+// skip the idle time. Each hart has its own mtimecmp and deadline.
+
+#define MIE_MTIE (1 << 7)
+
+static uint64_t tick_period = 0; // us, 0: no tick
+static uint64_t next_tick = 0;
+// deadline of a running sleep_until() on each hart
+static uint64_t wake_at[NR_CPU] = { [0 ... NR_CPU - 1] = -1 };
+
+static void mtimecmp_write(int hart, uint64_t t) {
+  uintptr_t addr = MTIMECMP_ADDR(hart);
+#if __riscv_xlen == 64 && defined(MTIME_READ_MMIO64)
+  *(volatile uint64_t *)addr = t;
+#else
+  // keep the high half out of reach while the low half changes,
+  // so no spurious interrupt fires in between
+  outl(addr + 4, 0xffffffff);
+  outl(addr + 0, (uint32_t)t);
+  outl(addr + 4, (uint32_t)(t >> 32));
+#endif
+}
+
+// arm mtimecmp of @hart for its earliest pending event
+static void mtimecmp_arm(int hart, bool with_tick) {
+  uint64_t t = wake_at[hart];
+  if (hart == 0 && with_tick && tick_period != 0 && next_tick < t) t = next_tick;
+  mtimecmp_write(hart, t);
+}
+
+// hart 0 only, like every other interrupt
+void cte_set_tick(uint64_t us) {
+  panic_on(cpu_current() != 0, "cte_set_tick() on a secondary hart");
+  tick_period = us;
+  if (us != 0) {
+    next_tick = __am_mtime() + us;
+    asm volatile("csrs mie, %0" : : "r"(MIE_MTIE));
+  } else if (wake_at[0] == (uint64_t)-1) {
+    asm volatile("csrc mie, %0" : : "r"(MIE_MTIE));
+  }
+  mtimecmp_arm(0, true);
+}
+
+bool __am_timer_irq() {
+  int hart = cpu_current();
+  uint64_t now = __am_mtime();
+  bool tick = (hart == 0 && tick_period != 0 && next_tick <= now);
+  if (tick) {
+    next_tick += tick_period;
+    if (next_tick <= now) {
+      next_tick = now + tick_period; // drop ticks we were too late for
+    }
+  }
+  if (wake_at[hart] <= now) {
+    wake_at[hart] = -1; // sleep_until() notices by itself
+  }
+  mtimecmp_arm(hart, true);
+  return tick;
+}
+
+void sleep_until(uint64_t us) {
+  uint64_t deadline = __am_boot_time + us;
+  int hart = cpu_current();
+  bool ien = ienabled();
+
+  // wfi also wakes up on a pending interrupt while mstatus.MIE is clear,
+  // so checking the deadline and sleeping cannot race with the handler
+  iset(false);
+  uintptr_t mie = 0;
+  if (ien) {
+    asm volatile("csrs mie, %0" : : "r"(MIE_MTIE));
+  } else {
+    // no handler can run, so a pending device interrupt (e.g. an unread
+    // key) would end every wfi at once: wait for our deadline only
+    asm volatile("csrrw %0, mie, %1" : "=r"(mie) : "r"(MIE_MTIE));
+  }
+  while (__am_mtime() < deadline) {
+    wake_at[hart] = deadline;
+    // a tick nobody can take would only wake us up again and again
+    mtimecmp_arm(hart, ien);
+    asm volatile("wfi");
+    if (ien) {
+      // let the pending interrupt (tick, device) be handled
+      iset(true);
+      iset(false);
+    }
+  }
+  wake_at[hart] = -1;
+  if (!ien) {
+    asm volatile("csrw mie, %0" : : "r"(mie));
+  }
+  if (hart != 0 || tick_period == 0) {
+    asm volatile("csrc mie, %0" : : "r"(MIE_MTIE));
+  }
+  mtimecmp_arm(hart, true);
+  iset(ien);
+}
@@ -1,5 +1,6 @@
 #include <am.h>
 #include <riscv/riscv.h>
+#include <npc.h>
 #include <klib.h>
 #include <klib-macros.h>
 #include <stdint.h>
@@ -10,74 +11,270 @@ typedef Context *(*handler_t)(Event, Context *);
 
 static handler_t user_handler = NULL;
 
-static void handle_unaligned_load(Context *c) {
-  uint32_t instr = *(uint32_t *)c->mepc;
-  uint32_t rd = (instr >> 7) & 0x1F;
-  uint32_t funct3 = (instr >> 12) & 0x7;
+// Syscalls with a handler in this table (indexed by a7) bypass Event
+// construction and user_handler; the rest are still EVENT_SYSCALL.
+typedef uintptr_t (*syscall_t)(uintptr_t, uintptr_t, uintptr_t,
+                               uintptr_t, uintptr_t, uintptr_t);
+static const syscall_t *syscall_table = NULL;
+static uintptr_t syscall_nr = 0;
 
-  uintptr_t addr = c->mtval;
-  uintptr_t value = 0;
-
-  switch (funct3) {
-    case 0: // LB
-      value = (int8_t)*(uint8_t *)addr;
-      break;
-    case 1: // LH
-      value = (int16_t)(*(uint8_t *)addr | (*(uint8_t *)(addr + 1) << 8));
-      break;
-    case 2: // LW
-      value = *(uint8_t *)addr |
-              (*(uint8_t *)(addr + 1) << 8) |
-              (*(uint8_t *)(addr + 2) << 16) |
-              (*(uint8_t *)(addr + 3) << 24);
-      break;
-    case 4: // LBU
-      value = *(uint8_t *)addr;
-      break;
-    case 5: // LHU
-      value = *(uint8_t *)addr | (*(uint8_t *)(addr + 1) << 8);
-      break;
-    default:
-      printf("unknown load funct3: %d\n", funct3); panic("");
-  }
-
-  // x0 不可写
-  if (rd != 0) {
-    c->gpr[rd] = value;
-  }
-  c->mepc += 4;
-}
-
-static void handle_unaligned_store(Context *c) {
-  uint32_t instr = *(uint32_t *)c->mepc;
-  uint32_t funct3 = (instr >> 12) & 0x7;
-  uint32_t rs2 = (instr >> 20) & 0x1F;
+// ================================================================
+// misaligned load/store emulation
+// ================================================================
+// A load reads the one or two aligned doublewords it touches and merges
+// them, so it never crosses a page by itself. A store writes only the
+// bytes it names, as naturally aligned sb/sh/sw pieces: a read-modify-write
+// of the whole doubleword could undo a concurrent store of another hart
+// to a neighbouring byte, and would touch device registers next to the
+// target. For a trap from a lower privilege level the accesses go through
+// mstatus.MPRV, i.e. through the page table and permissions of the
+// trapped code.
+
+#define MSTATUS_MPP  (3 << 11)
+#define MSTATUS_MPRV (1 << 17)
+#define MSTATUS_MXR  (1 << 19)
+
+static inline uint64_t load64(uintptr_t addr, bool mprv) {
+  uint64_t v;
+  if (mprv) {
+    asm volatile("csrs mstatus, %2; ld %0, 0(%1); csrc mstatus, %2"
+        : "=&r"(v) : "r"(addr), "r"(MSTATUS_MPRV) : "memory");
+  } else {
+    v = *(volatile uint64_t *)addr;
+  }
+  return v;
+}
+
+#define DEF_STORE(name, insn, type) \
+  static inline void name(uintptr_t addr, uint64_t v, bool mprv) { \
+    if (mprv) { \
+      asm volatile("csrs mstatus, %2; " insn " %0, 0(%1); csrc mstatus, %2" \
+          : : "r"(v), "r"(addr), "r"(MSTATUS_MPRV) : "memory"); \
+    } else { \
+      *(volatile type *)addr = v; \
+    } \
+  }
+
+DEF_STORE(store8,  "sb", uint8_t)
+DEF_STORE(store16, "sh", uint16_t)
+DEF_STORE(store32, "sw", uint32_t)
+
+// 16-bit instruction parcel at @pc (2-aligned, so within one doubleword).
+// MXR lets the load read an execute-only (MMAP_EXEC without MMAP_READ)
+// page; it is set only for this fetch, not for the emulated access.
+static inline uint32_t fetch16(uintptr_t pc, bool mprv) {
+  uintptr_t base = pc & ~(uintptr_t)7;
+  uint64_t v;
+  if (mprv) {
+    asm volatile("csrs mstatus, %2; ld %0, 0(%1); csrc mstatus, %2"
+        : "=&r"(v) : "r"(base), "r"(MSTATUS_MPRV | MSTATUS_MXR) : "memory");
+  } else {
+    v = *(volatile uint64_t *)base;
+  }
+  return (v >> ((pc & 7) * 8)) & 0xffff;
+}
+
+static inline uint64_t len_mask(int len) {
+  return (len == 8 ? (uint64_t)-1 : (1ull << (len * 8)) - 1);
+}
+
+// @len bytes at @addr, zero-extended
+static uint64_t misaligned_read(uintptr_t addr, int len, bool mprv) {
+  uintptr_t base = addr & ~(uintptr_t)7;
+  int sh = (addr & 7) * 8;
+  uint64_t v = load64(base, mprv) >> sh;
+  if ((addr & 7) + len > 8) {
+    v |= load64(base + 8, mprv) << (64 - sh); // sh != 0 here
+  }
+  return v & len_mask(len);
+}
+
+// low @len bytes of @v to @addr, in the widest aligned pieces that fit
+static void misaligned_write(uintptr_t addr, int len, uint64_t v, bool mprv) {
+  while (len > 0) {
+    if ((addr & 3) == 0 && len >= 4) {
+      store32(addr, v, mprv);
+      addr += 4; len -= 4; v >>= 32;
+    } else if ((addr & 1) == 0 && len >= 2) {
+      store16(addr, v, mprv);
+      addr += 2; len -= 2; v >>= 16;
+    } else {
+      store8(addr, v, mprv);
+      addr += 1; len -= 1; v >>= 8;
+    }
+  }
+}
+
+#ifdef UNALIGNED_PROF
+// Per-PC counts of emulated accesses, dumped by halt(). Symbolize the
+// dump with tools/unaligned-sym.py.
+#define UPROF_SIZE 256 // power of 2
+#define UPROF_TOP  16
+
+static struct {
+  uintptr_t pc;
+  uint32_t loads, stores;
+  uint64_t bytes;
+} uprof[UPROF_SIZE];
+static uint64_t uprof_lost = 0;
+
+static void uprof_record(uintptr_t pc, bool store, int width) {
+  uint32_t i = ((uint32_t)(pc >> 1) * 2654435761u) & (UPROF_SIZE - 1);
+  for (int n = 0; n < UPROF_SIZE; n++, i = (i + 1) & (UPROF_SIZE - 1)) {
+    if (uprof[i].pc == pc || uprof[i].pc == 0) {
+      uprof[i].pc = pc;
+      if (store) uprof[i].stores++;
+      else uprof[i].loads++;
+      uprof[i].bytes += width;
+      return;
+    }
+  }
+  uprof_lost++; // table full
+}
+
+void __am_unaligned_dump() {
+  uint64_t total = 0;
+  int n = 0;
+  for (int i = 0; i < UPROF_SIZE; i++) {
+    if (uprof[i].pc != 0) {
+      total += (uint64_t)uprof[i].loads + uprof[i].stores;
+      n++;
+    }
+  }
+  printf("[unaligned] %d sites, %lu traps, %lu lost\n", n,
+      (unsigned long)total, (unsigned long)uprof_lost);
+  // selection of the top entries; the table is consumed since we halt anyway
+  for (int k = 0; k < UPROF_TOP && k < n; k++) {
+    int best = -1;
+    for (int i = 0; i < UPROF_SIZE; i++) {
+      if (uprof[i].pc == 0) continue;
+      if (best < 0 || (uint64_t)uprof[i].loads + uprof[i].stores >
+                      (uint64_t)uprof[best].loads + uprof[best].stores) best = i;
+    }
+    printf("[unaligned] pc=%p loads=%lu stores=%lu bytes=%lu\n", (void *)uprof[best].pc,
+        (unsigned long)uprof[best].loads, (unsigned long)uprof[best].stores,
+        (unsigned long)uprof[best].bytes);
+    uprof[best].pc = 0;
+  }
+}
+#endif
+
+typedef struct {
+  int len;      // instruction length in bytes
+  int width;    // access width in bytes
+  bool sext;    // sign-extend the loaded value
+  int reg;      // rd for loads, rs2 for stores
+} mem_insn_t;
+
+// Decode the load (@store = false) or store at @pc. Returns false if it
+// is not an integer load/store of RV64I or RVC.
+static bool decode_mem_insn(uintptr_t pc, bool store, bool mprv, mem_insn_t *d) {
+  uint32_t insn = fetch16(pc, mprv);
+  uint32_t funct3;
+  if ((insn & 3) == 3) {
+    insn |= fetch16(pc + 2, mprv) << 16;
+    funct3 = (insn >> 12) & 7;
+    d->len = 4;
+    if (!store && (insn & 0x7f) == 0x03 && funct3 != 7) { // LB LH LW LD LBU LHU LWU
+      d->width = 1 << (funct3 & 3);
+      d->sext = !(funct3 & 4);
+      d->reg = (insn >> 7) & 0x1f;
+      return true;
+    }
+    if (store && (insn & 0x7f) == 0x23 && funct3 < 4) { // SB SH SW SD
+      d->width = 1 << funct3;
+      d->reg = (insn >> 20) & 0x1f;
+      return true;
+    }
+    return false;
+  }
+
+  // RVC: C.LW C.LD C.SW C.SD (x8-x15) and C.LWSP C.LDSP C.SWSP C.SDSP
+  funct3 = (insn >> 13) & 7;
+  d->len = 2;
+  d->sext = true;
+  switch ((insn & 3) << 3 | funct3) {
+    case 0x02: d->width = 4; d->reg = ((insn >> 2) & 7) + 8; return !store; // C.LW
+    case 0x03: d->width = 8; d->reg = ((insn >> 2) & 7) + 8; return !store; // C.LD
+    case 0x06: d->width = 4; d->reg = ((insn >> 2) & 7) + 8; return store;  // C.SW
+    case 0x07: d->width = 8; d->reg = ((insn >> 2) & 7) + 8; return store;  // C.SD
+    case 0x12: d->width = 4; d->reg = (insn >> 7) & 0x1f;    return !store; // C.LWSP
+    case 0x13: d->width = 8; d->reg = (insn >> 7) & 0x1f;    return !store; // C.LDSP
+    case 0x16: d->width = 4; d->reg = (insn >> 2) & 0x1f;    return store;  // C.SWSP
+    case 0x17: d->width = 8; d->reg = (insn >> 2) & 0x1f;    return store;  // C.SDSP
+    default: return false;
+  }
+}
+
+static void handle_unaligned(Context *c, bool store) {
+  bool mprv = (c->mstatus & MSTATUS_MPP) != MSTATUS_MPP;
+  mem_insn_t d;
+  if (!decode_mem_insn(c->mepc, store, mprv, &d)) {
+    printf("unknown misaligned %s at pc = %p\n", store ? "store" : "load", (void *)c->mepc);
+    panic("");
+  }
+
+#ifdef UNALIGNED_PROF
+  uprof_record(c->mepc, store, d.width);
+#endif
 
   uintptr_t addr = c->mtval;
-  uintptr_t value = c->gpr[rs2];
+  if (store) {
+    uint64_t value = (d.reg != 0 ? c->gpr[d.reg] : 0); // gpr[0] is not saved
+    misaligned_write(addr, d.width, value, mprv);
+  } else {
+    uint64_t value = misaligned_read(addr, d.width, mprv);
+    if (d.sext && d.width < 8) {
+      int sh = 64 - d.width * 8;
+      value = (uint64_t)((int64_t)(value << sh) >> sh);
+    }
+    // x0 不可写
+    if (d.reg != 0) {
+      c->gpr[d.reg] = value;
+    }
+  }
+  c->mepc += d.len;
+}
+
+// machine timer interrupt
+static Context *timer_irq(Context *c) {
+  if (__am_timer_irq() && user_handler) {
+    Event ev = { .event = EVENT_IRQ_TIMER };
+    c = user_handler(ev, c);
+  }
+  return c;
+}
 
-  switch (funct3) {
-    case 0: // SB
-      *(uint8_t *)addr = value & 0xFF;
-      break;
-    case 1: // SH
-      *(uint8_t *)addr = value & 0xFF;
-      *(uint8_t *)(addr + 1) = (value >> 8) & 0xFF;
-      break;
-    case 2: // SW
-      *(uint8_t *)addr = value & 0xFF;
-      *(uint8_t *)(addr + 1) = (value >> 8) & 0xFF;
-      *(uint8_t *)(addr + 2) = (value >> 16) & 0xFF;
-      *(uint8_t *)(addr + 3) = (value >> 24) & 0xFF;
-      break;
-    default:
-      printf("unknown store funct3: %d\n", funct3); panic("");
+// machine external interrupt
+static Context *ext_irq(Context *c) {
+  uint32_t irq;
+  while ((irq = __am_plic_claim()) != 0) {
+    if (!__am_plic_handle(irq) && user_handler) {
+      Event ev = { .event = EVENT_IRQ_IODEV, .cause = irq };
+      c = user_handler(ev, c);
+    }
+    __am_plic_complete(irq);
   }
+  return c;
+}
+
+// C side of the vectored timer and external interrupt entries in trap.S
+Context *__am_timer_handle(Context *c) {
+  __am_get_cur_as(c);
+  Context *next = timer_irq(c);
+  __am_switch(next);
+  return next;
+}
 
-  c->mepc += 4;
+Context *__am_extirq_handle(Context *c) {
+  __am_get_cur_as(c);
+  Context *next = ext_irq(c);
+  __am_switch(next);
+  return next;
 }
 
 Context *__am_irq_handle(Context *c) {
+  __am_get_cur_as(c);
   if (user_handler) {
     Event ev = {0};
     uintptr_t mcause = c->mcause;
@@ -85,6 +282,10 @@ Context *__am_irq_handle(Context *c) {
     if ((intptr_t)mcause < 0) {
       uintptr_t interrupt_id = mcause & ((uintptr_t)-1 >> 1);
       switch (interrupt_id) {
+        case 7: // machine timer interrupt
+          c = timer_irq(c); break;
+        case 11: // machine external interrupt
+          c = ext_irq(c); break;
         default:
           ev.event = EVENT_ERROR;
           ev.cause = mcause;
@@ -93,39 +294,71 @@ Context *__am_irq_handle(Context *c) {
     } else {
       switch (mcause) {
         case 4: // load address misaligned
-          handle_unaligned_load(c); break;
+          handle_unaligned(c, false); break;
         case 6: // store/AMO address misaligned
-          handle_unaligned_store(c); break;
-        case 11: // ecall from M-mode
+          handle_unaligned(c, true); break;
+        case 8:  // ecall from U-mode
+        case 11: { // ecall from M-mode
           c->mepc += 4;
-          if (c->GPR1 == (uintptr_t)-1) {
+          uintptr_t no = c->GPR1;
+          if (no == (uintptr_t)-1) {
             ev.event = EVENT_YIELD;
+          } else if (no < syscall_nr && syscall_table[no] != NULL) {
+            c->GPRx = syscall_table[no](c->gpr[10], c->gpr[11], c->gpr[12],
+                                        c->gpr[13], c->gpr[14], c->gpr[15]);
           } else {
             ev.event = EVENT_SYSCALL;
           }
           break;
+        }
+        case 12: // instruction page fault
+        case 13: // load page fault
+        case 15: // store/AMO page fault
+          ev.event = EVENT_PAGEFAULT;
+          ev.cause = (mcause == 12 ? MMAP_EXEC : mcause == 13 ? MMAP_READ : MMAP_WRITE);
+          ev.ref = c->mtval; // faulting virtual address
+          break;
         default:
           ev.event = EVENT_ERROR;
           ev.cause = mcause;
           break;
       }
     }
-    c = user_handler(ev, c);
+    // traps fully handled inside AM (e.g. device interrupts) are not reported
+    if (ev.event != EVENT_NULL) {
+      c = user_handler(ev, c);
+    }
   }
 
+  __am_switch(c);
   return c;
 }
 
 extern void __am_asm_trap(void);
+extern void __am_vector_table(void);
 
 bool cte_init(handler_t handler) {
-  asm volatile("csrw mtvec, %0" : : "r"(__am_asm_trap));
+  uintptr_t mtvec = (uintptr_t)__am_asm_trap;
+#if MTVEC_VECTORED
+  // mtvec.MODE is WARL: keep direct mode if vectored mode does not stick
+  uintptr_t vec = (uintptr_t)__am_vector_table | 1;
+  asm volatile("csrw mtvec, %0; csrr %0, mtvec" : "+r"(vec));
+  if ((vec & 3) == 1) mtvec = vec;
+#endif
+  asm volatile("csrw mtvec, %0" : : "r"(mtvec));
+  // M-mode runs with mscratch = 0, see TRAP_ENTER in trap.S
+  asm volatile("csrw mscratch, zero");
 
   user_handler = handler;
 
   return true;
 }
 
+void cte_syscall_table(const syscall_t *table, int nr) {
+  syscall_table = table;
+  syscall_nr = (table != NULL && nr > 0 ? nr : 0);
+}
+
 typedef void (*entry_t)(void *);
 
 Context *kcontext(Area kstack, entry_t entry, void *arg) {
@@ -135,7 +368,7 @@ Context *kcontext(Area kstack, entry_t entry, void *arg) {
   }
   c->mepc = (uintptr_t)entry;
   c->gpr[10] = (uintptr_t)arg; // a0
-  c->mstatus = 0x1800; // MPP = 3 (M-mode)
+  c->mstatus = 0x1880; // MPP = 3 (M-mode), MPIE = 1: interrupts on after mret
   c->mcause = 0x1800;
   c->pdir = NULL;
   return c;
@@ -145,9 +378,18 @@ __attribute__((weak)) void yield() {
   asm volatile("li a7, -1; ecall");
 }
 
+#define MSTATUS_MIE (1 << 3)
+
 bool ienabled() {
-  return false;
+  uintptr_t mstatus;
+  asm volatile("csrr %0, mstatus" : "=r"(mstatus));
+  return (mstatus & MSTATUS_MIE) != 0;
 }
 
 void iset(bool enable) {
+  if (enable) {
+    asm volatile("csrs mstatus, %0" : : "r"(MSTATUS_MIE));
+  } else {
+    asm volatile("csrc mstatus, %0" : : "r"(MSTATUS_MIE));
+  }
 }
@@ -1,4 +1,11 @@
+#include <stdint.h>
+
 extern void ssbl(void);
+extern void __am_mpe_secondary(void);
+
+// set to MPE_MAGIC by mpe_init() (mpe.c) to release the secondary harts
+extern volatile uint64_t __am_mpe_release;
+#define MPE_MAGIC 0x4d50454d50454d50ull
 
 extern int _ssbl_lma;
 extern int _ssbl_vma_start;
@@ -16,3 +23,15 @@ void fsbl(void) {
   asm volatile("fence.i" ::: "memory");
   ssbl();
 }
+
+// Secondary harts spin here, still executing from flash, while hart 0
+// copies the program and runs until mpe_init().
+void fsbl_park(void) {
+  while (__am_mpe_release != MPE_MAGIC) ;
+  // pairs with the fence rw, w in mpe_init(): the loads of what it
+  // published must not be satisfied before the flag was seen
+  asm volatile("fence r, rw" ::: "memory");
+  // the program was copied by another hart
+  asm volatile("fence.i" ::: "memory");
+  __am_mpe_secondary();
+}
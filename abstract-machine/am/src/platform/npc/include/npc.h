@@ -16,7 +16,10 @@
 #define VGA_SIZE (0x200000)
 
 #define KBD_ADDR        (0x10011000)
-#define RTC_ADDR        (CLINT_BASE + 0xBFF8)
+// KBD_IRQ: PLIC source of the PS/2 controller, from npc-soc-config.mk
+#define RTC_ADDR        (CLINT_BASE + 0xBFF8) // mtime
+#define MTIMECMP_ADDR(h) (CLINT_BASE + 0x4000 + 8 * (h)) // mtimecmp of hart h
+#define MSIP_ADDR(hart) (CLINT_BASE + 4 * (hart)) // software interrupt
 #define VGACTL_ADDR     (VGA_BASE + VGA_SIZE - 0x100)
 #define AUDIO_ADDR      0
 #define DISK_ADDR       0
@@ -31,6 +34,60 @@ extern char _sdram_base;
 
 #define PMEM_END SDRAM_END
 
+#if __riscv_xlen == 64 && (defined(MTIME_READ_MMIO64) || defined(MTIME_READ_CSR))
+#define MTIME_FAST 1
+#endif
+
+// CLINT mtime (1 tick = 1 us); MTIME_READ in npc-soc-config.mk picks
+// one ld, the time CSR or the split 32-bit read
+static inline uint64_t __am_mtime() {
+#if defined(MTIME_FAST) && defined(MTIME_READ_CSR)
+  uint64_t t;
+  asm volatile("csrr %0, time" : "=r"(t));
+  return t;
+#elif defined(MTIME_FAST)
+  return *(volatile uint64_t *)RTC_ADDR;
+#else
+  uint32_t hi, lo;
+  do {
+    hi = inl(RTC_ADDR + 4);
+    lo = inl(RTC_ADDR + 0);
+  } while (hi != inl(RTC_ADDR + 4));
+  return ((uint64_t)hi << 32) | lo;
+#endif
+}
+
+static inline uint64_t __am_mcycle() {
+  uintptr_t c;
+  asm volatile("csrr %0, mcycle" : "=r"(c));
+  return c;
+}
+
+extern uint64_t __am_boot_time; // mtime at uptime 0 (ioe/timer.c)
+
+// CLINT timer interrupt (clint.c); true if a tick is due for the user
+bool __am_timer_irq(void);
+
+// per-PC misaligned access counts (cte.c, make UNALIGNED_PROF=1)
+void __am_unaligned_dump(void);
+
+// Sv39 (vme.c): save the current address space into c->pdir on trap
+// entry, load the one of the Context being resumed on the way out
+void __am_get_cur_as(Context *c);
+void __am_switch(Context *c);
+
+// PLIC (plic.c): __am_plic_enable() routes source @irq to an AM-internal
+// handler; the rest is the claim/complete loop of __am_irq_handle
+void __am_plic_enable(int irq, void (*handler)(void));
+bool __am_plic_enabled(int irq);
+uint32_t __am_plic_claim(void);
+void __am_plic_complete(uint32_t irq);
+bool __am_plic_handle(uint32_t irq);
+
+// disk request queue (ioe/diskq.c): a backend reports that the request
+// submitted with @tag has finished, possibly from its interrupt handler
+void __am_diskq_complete(uintptr_t tag);
+
 #define SIM_PADDR_SPACE \
   RANGE(&_flash_base, FLASH_END), \
   RANGE(&_sdram_base, PMEM_END), \
@@ -0,0 +1,202 @@
+#include <am.h>
+#include <npc.h>
+#include <klib.h>
+
+// Block cache in front of the disk backend.
+//
+// DISK_BCACHE blocks are kept in SDRAM, found through a hash table and
+// recycled in LRU order. Writes are write-back: a dirty block reaches the
+// backend only when it is evicted or on AM_DISK_FLUSH. Sequential reads
+// are detected and trigger a growing read-ahead window.
+
+#define DISK_BLK_SIZE 512
+
+void __am_ramdisk_blkio(AM_DISK_BLKIO_T *io);
+bool __am_ramdisk_readonly();
+
+static void backend_rw(bool write, void *buf, uint32_t blkno, uint32_t blkcnt) {
+  AM_DISK_BLKIO_T io = { .write = write, .buf = buf, .blkno = blkno, .blkcnt = blkcnt };
+  __am_ramdisk_blkio(&io);
+}
+
+#if DISK_BCACHE > 0
+
+#define BCACHE_HASH 128 // number of hash buckets, power of 2
+#define RA_MAX      16  // largest read-ahead window (in blocks)
+// largest batch brought in at once; never more than half of the cache,
+// so a batch cannot evict its own blocks
+#define FILL_MAX    (DISK_BCACHE < 2 * RA_MAX ? (DISK_BCACHE + 1) / 2 : RA_MAX)
+
+typedef struct bcache_buf {
+  uint32_t blkno;
+  bool valid, dirty;
+  struct bcache_buf *hnext;      // hash chain
+  struct bcache_buf *prev, *next; // LRU list, lru.next is the most recent
+  uint8_t data[DISK_BLK_SIZE];
+} bcache_buf_t;
+
+static bcache_buf_t bufs[DISK_BCACHE];
+static bcache_buf_t *htab[BCACHE_HASH];
+static bcache_buf_t lru;
+static bool bcache_ready = false;
+static bool bcache_ro = false; // the backend rejects writes
+
+// read-ahead state: where the last read ended and the current window
+static uint32_t ra_next = -1;
+static uint32_t ra_win = 0;
+
+static inline bcache_buf_t **bucket(uint32_t blkno) {
+  return &htab[(blkno ^ (blkno >> 7)) & (BCACHE_HASH - 1)];
+}
+
+static void lru_unlink(bcache_buf_t *b) {
+  b->prev->next = b->next;
+  b->next->prev = b->prev;
+}
+
+static void lru_push_front(bcache_buf_t *b) {
+  b->next = lru.next;
+  b->prev = &lru;
+  lru.next->prev = b;
+  lru.next = b;
+}
+
+static void bcache_init() {
+  lru.next = lru.prev = &lru;
+  for (int i = 0; i < DISK_BCACHE; i++) {
+    lru_push_front(&bufs[i]);
+  }
+  bcache_ro = __am_ramdisk_readonly();
+  bcache_ready = true;
+}
+
+static bcache_buf_t *lookup(uint32_t blkno) {
+  for (bcache_buf_t *b = *bucket(blkno); b != NULL; b = b->hnext) {
+    if (b->blkno == blkno) return b;
+  }
+  return NULL;
+}
+
+static void unhash(bcache_buf_t *b) {
+  bcache_buf_t **p = bucket(b->blkno);
+  while (*p != b) p = &(*p)->hnext;
+  *p = b->hnext;
+}
+
+static void writeback(bcache_buf_t *b) {
+  if (b->dirty) {
+    backend_rw(true, b->data, b->blkno, 1);
+    b->dirty = false;
+  }
+}
+
+// Take the least recently used buffer and rebind it to `blkno`.
+// The returned buffer has no valid data yet.
+static bcache_buf_t *evict(uint32_t blkno) {
+  bcache_buf_t *b = lru.prev;
+  if (b->valid) {
+    writeback(b);
+    unhash(b);
+  }
+  b->blkno = blkno;
+  b->valid = false;
+  b->hnext = *bucket(blkno);
+  *bucket(blkno) = b;
+  return b;
+}
+
+static void touch(bcache_buf_t *b) {
+  lru_unlink(b);
+  lru_push_front(b);
+}
+
+// Bring [blkno, blkno + cnt) into the cache, cnt <= FILL_MAX. Contiguous
+// misses are read from the backend in one request through a bounce buffer.
+static void fill(uint32_t blkno, uint32_t cnt) {
+  static uint8_t bounce[FILL_MAX * DISK_BLK_SIZE];
+  uint32_t end = blkno + cnt;
+  while (blkno < end) {
+    if (lookup(blkno) != NULL) { blkno++; continue; }
+    uint32_t n = 1;
+    while (blkno + n < end && lookup(blkno + n) == NULL) n++;
+    backend_rw(false, bounce, blkno, n);
+    for (uint32_t i = 0; i < n; i++) {
+      bcache_buf_t *b = evict(blkno + i);
+      memcpy(b->data, bounce + i * DISK_BLK_SIZE, DISK_BLK_SIZE);
+      b->valid = true;
+      touch(b);
+    }
+    blkno += n;
+  }
+}
+
+static void readahead(uint32_t blkno, uint32_t blkcnt, uint32_t disk_blkcnt) {
+  if (blkno == ra_next) {
+    ra_win = (ra_win == 0 ? 2 : ra_win * 2);
+    if (ra_win > RA_MAX) ra_win = RA_MAX;
+  } else {
+    ra_win = 0;
+  }
+  ra_next = blkno + blkcnt;
+  if (ra_win == 0 || ra_next >= disk_blkcnt) return;
+
+  uint32_t n = (ra_win < FILL_MAX ? ra_win : FILL_MAX);
+  if (ra_next + n > disk_blkcnt) n = disk_blkcnt - ra_next;
+  fill(ra_next, n);
+}
+
+void __am_disk_config(AM_DISK_CONFIG_T *cfg);
+
+void __am_disk_blkio(AM_DISK_BLKIO_T *io) {
+  if (!bcache_ready) bcache_init();
+  // fail here rather than on the writeback of the dirty block
+  panic_on(io->write && bcache_ro, "ramdisk is read-only");
+
+  uint8_t *buf = io->buf;
+  uint32_t blkno = io->blkno;
+  for (int i = 0; i < io->blkcnt; i++, blkno++, buf += DISK_BLK_SIZE) {
+    bcache_buf_t *b = lookup(blkno);
+    if (io->write) {
+      if (b == NULL) b = evict(blkno);
+      memcpy(b->data, buf, DISK_BLK_SIZE);
+      b->valid = b->dirty = true;
+    } else {
+      if (b == NULL) {
+        uint32_t left = io->blkcnt - i;
+        fill(blkno, left < FILL_MAX ? left : FILL_MAX);
+        b = lookup(blkno);
+      }
+      memcpy(buf, b->data, DISK_BLK_SIZE);
+    }
+    touch(b);
+  }
+
+  if (!io->write) {
+    AM_DISK_CONFIG_T cfg;
+    __am_disk_config(&cfg);
+    readahead(io->blkno, io->blkcnt, cfg.blkcnt);
+  }
+}
+
+void __am_disk_flush(AM_DISK_FLUSH_T *flush) {
+  if (!bcache_ready) return;
+  for (int i = 0; i < DISK_BCACHE; i++) {
+    bcache_buf_t *b = &bufs[i];
+    if (!b->valid) continue;
+    writeback(b);
+    if (flush->invalidate) {
+      unhash(b);
+      b->valid = false;
+    }
+  }
+}
+
+#else
+
+void __am_disk_blkio(AM_DISK_BLKIO_T *io) {
+  backend_rw(io->write, io->buf, io->blkno, io->blkcnt);
+}
+
+void __am_disk_flush(AM_DISK_FLUSH_T *flush) { }
+
+#endif
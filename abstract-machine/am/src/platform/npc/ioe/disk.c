@@ -2,26 +2,176 @@
 #include <npc.h>
 #include <klib.h>
 
+// The ramdisk image stays in flash (see `.ramdisk` in npc-linker.ld).
+// With RAMDISK_CACHE, every block is paged into an SDRAM shadow on its
+// first access and served from there afterwards; writes only touch the
+// shadow. Without it, reads go straight to flash and the disk is read-only.
+// An image built by tools/mkzdisk.py is recognized by its header and
+// decompressed one chunk at a time into a small cache instead; such a
+// disk is read-only.
+// AM_DISK_BLKIO itself goes through the block cache in bcache.c, and
+// AM_DISK_SUBMIT/AM_DISK_REAP through the request queue in diskq.c.
+
 extern unsigned char _ramdisk_start[];
 extern unsigned char _ramdisk_end[];
+extern unsigned char _ramdisk_cache[];
+extern uint64_t _ramdisk_map[]; // residency bitmap, cleared with .bss
+// The linker sizes the shadow and the bitmap (--defsym=_ramdisk_cache_en),
+// so ask it rather than RAMDISK_CACHE, which a stale object may disagree
+// with. Loaded from data: the absolute symbol is out of reach of auipc.
+extern char _ramdisk_cache_en[];
+static const uintptr_t ramdisk_cache_en = (uintptr_t)_ramdisk_cache_en;
 
 #define DISK_BLK_SIZE 512
 
+// ================================================================
+// compressed image (see tools/mkzdisk.py for the layout)
+// ================================================================
+#define ZDISK_MAGIC 0x4b53445a // "ZDSK"
+#define ZCHUNK_MAX  (DISK_BLK_SIZE << 4)
+#define ZCACHE_NR   4
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version, chunk_shift;
+  uint32_t blksz, nr_blks, nr_chunks, reserved;
+  uint32_t index[]; // nr_chunks + 1 offsets into the data area
+} zdisk_hdr_t;
+
+static const zdisk_hdr_t *zhdr = NULL;
+static const uint8_t *zdata = NULL;
+static bool zprobed = false;
+
+static struct {
+  int chunk; // -1: empty
+  uint32_t stamp;
+  uint8_t data[ZCHUNK_MAX];
+} zcache[ZCACHE_NR];
+static uint32_t zclock = 0;
+
+static const zdisk_hdr_t *zdisk() {
+  if (!zprobed) {
+    const zdisk_hdr_t *h = (const zdisk_hdr_t *)_ramdisk_start;
+    if (_ramdisk_end - _ramdisk_start >= sizeof(*h) && h->magic == ZDISK_MAGIC) {
+      panic_on(h->blksz != DISK_BLK_SIZE || (DISK_BLK_SIZE << h->chunk_shift) > ZCHUNK_MAX,
+          "unsupported compressed ramdisk");
+      zhdr = h;
+      zdata = (const uint8_t *)&h->index[h->nr_chunks + 1];
+      for (int i = 0; i < ZCACHE_NR; i++) zcache[i].chunk = -1;
+    }
+    zprobed = true;
+  }
+  return zhdr;
+}
+
+// LZ4 block format; returns the number of bytes produced, or -1. A
+// truncated or corrupted input never makes it read or write out of bounds.
+static int lz4_decompress(const uint8_t *src, int srclen, uint8_t *dst, int dstcap) {
+  const uint8_t *send = src + srclen;
+  uint8_t *d = dst, *dend = dst + dstcap;
+  while (src < send) {
+    uint8_t token = *src++;
+    uint32_t len = token >> 4, b;
+    if (len == 15) do {
+      if (src >= send) return -1;
+      b = *src++; len += b;
+    } while (b == 255);
+    if (len > dend - d || len > send - src) return -1;
+    for (; len > 0; len--) *d++ = *src++;
+    if (src >= send) break; // the last sequence has no match
+
+    if (send - src < 2) return -1;
+    uint32_t off = src[0] | (src[1] << 8);
+    src += 2;
+    len = (token & 0xf) + 4;
+    if ((token & 0xf) == 0xf) do {
+      if (src >= send) return -1;
+      b = *src++; len += b;
+    } while (b == 255);
+    if (off == 0 || off > d - dst || len > dend - d) return -1;
+    for (const uint8_t *m = d - off; len > 0; len--) *d++ = *m++;
+  }
+  return d - dst;
+}
+
+static const uint8_t *zchunk(const zdisk_hdr_t *h, int chunk) {
+  int victim = 0;
+  for (int i = 0; i < ZCACHE_NR; i++) {
+    if (zcache[i].chunk == chunk) {
+      zcache[i].stamp = ++zclock;
+      return zcache[i].data;
+    }
+    if (zcache[i].stamp < zcache[victim].stamp) victim = i;
+  }
+
+  int size = DISK_BLK_SIZE << h->chunk_shift;
+  const uint8_t *src = zdata + h->index[chunk];
+  int srclen = h->index[chunk + 1] - h->index[chunk];
+  uint8_t *dst = zcache[victim].data;
+  if (srclen == size) {
+    memcpy(dst, src, size); // stored raw
+  } else {
+    panic_on(lz4_decompress(src, srclen, dst, size) != size, "corrupted compressed ramdisk");
+  }
+  zcache[victim].chunk = chunk;
+  zcache[victim].stamp = ++zclock;
+  return dst;
+}
+
+static void zdisk_read(const zdisk_hdr_t *h, uint8_t *buf, uint32_t blk) {
+  uint32_t mask = (1u << h->chunk_shift) - 1;
+  const uint8_t *chunk = zchunk(h, blk >> h->chunk_shift);
+  memcpy(buf, chunk + (blk & mask) * DISK_BLK_SIZE, DISK_BLK_SIZE);
+}
+
+// ================================================================
+// ramdisk
+// ================================================================
 void __am_disk_config(AM_DISK_CONFIG_T *cfg) {
+  const zdisk_hdr_t *h = zdisk();
   cfg->present = (&_ramdisk_end != &_ramdisk_start);
   cfg->blksz = DISK_BLK_SIZE;
-  cfg->blkcnt = (_ramdisk_end - _ramdisk_start) / DISK_BLK_SIZE;
+  cfg->blkcnt = (h ? h->nr_blks : (_ramdisk_end - _ramdisk_start) / DISK_BLK_SIZE);
+}
+
+// a compressed image, or a flash one without an SDRAM shadow
+bool __am_ramdisk_readonly() {
+  return zdisk() != NULL || !ramdisk_cache_en;
 }
 
-void __am_disk_status(AM_DISK_STATUS_T *stat) {
-  stat->ready = true;
+static uint8_t *ramdisk_page_in(uint32_t blk, bool fill) {
+  uint64_t off = (uint64_t)blk * DISK_BLK_SIZE;
+  uint64_t bit = 1ull << (blk % 64);
+  if (!(_ramdisk_map[blk / 64] & bit)) {
+    if (fill) memcpy(_ramdisk_cache + off, _ramdisk_start + off, DISK_BLK_SIZE);
+    _ramdisk_map[blk / 64] |= bit;
+  }
+  return _ramdisk_cache + off;
 }
 
-void __am_disk_blkio(AM_DISK_BLKIO_T *io) {
-  uint8_t *base = _ramdisk_start + (uint64_t)io->blkno * DISK_BLK_SIZE;
-  uint32_t len = (uint32_t)io->blkcnt * DISK_BLK_SIZE;
-  if (io->write)
-    memcpy(base, io->buf, len);
-  else
-    memcpy(io->buf, base, len);
+void __am_ramdisk_blkio(AM_DISK_BLKIO_T *io) {
+  uint8_t *buf = io->buf;
+  uint32_t blk = io->blkno;
+  const zdisk_hdr_t *h = zdisk();
+  if (h != NULL) {
+    panic_on(io->write, "compressed ramdisk is read-only");
+    for (int i = 0; i < io->blkcnt; i++, blk++, buf += DISK_BLK_SIZE) {
+      zdisk_read(h, buf, blk);
+    }
+    return;
+  }
+
+  panic_on(io->write && !ramdisk_cache_en, "ramdisk is read-only without RAMDISK_CACHE");
+  for (int i = 0; i < io->blkcnt; i++, blk++, buf += DISK_BLK_SIZE) {
+    if (ramdisk_cache_en) {
+      // a write overwrites the whole block, so there is nothing to fetch
+      uint8_t *base = ramdisk_page_in(blk, !io->write);
+      if (io->write)
+        memcpy(base, buf, DISK_BLK_SIZE);
+      else
+        memcpy(buf, base, DISK_BLK_SIZE);
+    } else {
+      memcpy(buf, _ramdisk_start + (uint64_t)blk * DISK_BLK_SIZE, DISK_BLK_SIZE);
+    }
+  }
 }
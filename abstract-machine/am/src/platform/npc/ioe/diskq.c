@@ -0,0 +1,72 @@
+#include <am.h>
+#include <npc.h>
+#include <klib.h>
+#include <klib-sync.h>
+
+// Asynchronous disk requests.
+//
+// AM_DISK_SUBMIT puts {write, buf, blkno, blkcnt, tag} on the submission
+// queue and returns at once. Reading AM_DISK_REAP pops at most one finished
+// request (`done`, `tag`) from the completion queue; AM_DISK_STATUS only
+// reports whether another request fits (`ready`) and how many are not
+// reaped yet, so polling it takes nothing away from the queue's owner.
+// Requests complete in submission order.
+//
+// The ramdisk is memory, so a request finishes as soon as it is started.
+// A backend that can overlap (DMA, SPI with an IRQ) would only start the
+// transfer in diskq_kick() and call __am_diskq_complete() from its
+// interrupt handler instead.
+
+#define DISKQ_DEPTH 16 // power of 2
+
+void __am_disk_blkio(AM_DISK_BLKIO_T *io);
+
+static AM_DISK_SUBMIT_T sq[DISKQ_DEPTH];
+static uintptr_t cq[DISKQ_DEPTH];
+// free-running counters; sq_tail - cq_head requests are not reaped yet,
+// which also bounds the number of entries in the completion queue
+static uint32_t sq_head = 0, sq_tail = 0;
+static uint32_t cq_head = 0;
+static volatile uint32_t cq_tail = 0; // may move in an interrupt handler
+
+void __am_diskq_complete(uintptr_t tag) {
+  cq[cq_tail % DISKQ_DEPTH] = tag;
+  barrier(); // the tag is in place before the reaper sees the new tail
+  cq_tail++;
+}
+
+// start every queued request the backend can take
+static void diskq_kick() {
+  while (sq_head != sq_tail) {
+    AM_DISK_SUBMIT_T *req = &sq[sq_head % DISKQ_DEPTH];
+    AM_DISK_BLKIO_T io = { .write = req->write, .buf = req->buf,
+                           .blkno = req->blkno, .blkcnt = req->blkcnt };
+    __am_disk_blkio(&io);
+    sq_head++;
+    __am_diskq_complete(req->tag);
+  }
+}
+
+void __am_disk_submit(AM_DISK_SUBMIT_T *req) {
+  panic_on(sq_tail - cq_head >= DISKQ_DEPTH, "disk queue full, reap with AM_DISK_REAP first");
+  sq[sq_tail % DISKQ_DEPTH] = *req;
+  sq_tail++;
+  diskq_kick();
+}
+
+void __am_disk_status(AM_DISK_STATUS_T *stat) {
+  diskq_kick();
+  stat->inflight = sq_tail - cq_head;
+  stat->ready = (stat->inflight < DISKQ_DEPTH);
+}
+
+void __am_disk_reap(AM_DISK_REAP_T *reap) {
+  diskq_kick();
+  reap->done = (cq_head != cq_tail);
+  reap->tag = 0;
+  if (reap->done) {
+    barrier(); // read the slot only after the tail that covers it
+    reap->tag = cq[cq_head % DISKQ_DEPTH];
+    cq_head++;
+  }
+}
@@ -50,25 +50,66 @@ static int ps2_to_am_key(uint8_t sc, bool extended) {
   return am != 0 ? am : AM_KEY_NONE;
 }
 
+// ================================================================
+// scancode queue
+// ================================================================
+// The PS/2 interrupt handler decodes scancodes into key events. A make/break
+// sequence may span several interrupts, so the decoder keeps its prefix
+// state between bytes. Events go through a ring with one producer (the
+// interrupt handler) and one consumer (AM_INPUT_KEYBRD), so no lock is needed.
+// When the interrupt does not come (masked, disabled in the PLIC, or taken
+// over by the user), AM_INPUT_KEYBRD drains the controller itself. Only
+// hart 0 does so, as only hart 0 takes the interrupt: the ring never has
+// two producers.
+
+#define KBD_QLEN 64 // power of 2
+
+static AM_INPUT_KEYBRD_T kbd_q[KBD_QLEN];
+static volatile uint32_t kbd_head = 0, kbd_tail = 0;
+static bool kbd_ext = false, kbd_brk = false;
+
+#define barrier() asm volatile("" ::: "memory")
+
+static void kbd_feed(uint8_t sc) {
+  if (sc == 0xE0) { kbd_ext = true; return; }
+  if (sc == 0xF0) { kbd_brk = true; return; }
+
+  int keycode = ps2_to_am_key(sc, kbd_ext);
+  bool keydown = !kbd_brk;
+  kbd_ext = kbd_brk = false;
+
+  uint32_t tail = kbd_tail;
+  if (keycode == AM_KEY_NONE || tail - kbd_head == KBD_QLEN) return; // drop when full
+  kbd_q[tail % KBD_QLEN] = (AM_INPUT_KEYBRD_T){ .keydown = keydown, .keycode = keycode };
+  barrier();
+  kbd_tail = tail + 1;
+}
+
+// move every byte the controller holds into the decoder (0: FIFO empty)
+static void kbd_drain() {
+  uint8_t sc;
+  while ((sc = inb(KBD_ADDR)) != 0) {
+    kbd_feed(sc);
+  }
+}
+
+void __am_input_init() {
+  __am_plic_enable(KBD_IRQ, kbd_drain);
+}
+
 void __am_input_keybrd(AM_INPUT_KEYBRD_T *kbd) {
-  uint8_t kc = inb(KBD_ADDR);
+  // the handler cannot run now (mstatus.MIE), or never will
+  if (cpu_current() == 0 && (!ienabled() || !__am_plic_enabled(KBD_IRQ))) {
+    kbd_drain();
+  }
 
-  if (kc == 0xF0) {
-    uint8_t sc = inb(KBD_ADDR);
+  uint32_t head = kbd_head;
+  if (head == kbd_tail) {
     kbd->keydown = false;
-    kbd->keycode = ps2_to_am_key(sc, false);
-  } else if (kc == 0xE0) {
-    uint8_t next = inb(KBD_ADDR);
-    if (next == 0xF0) {
-      uint8_t sc = inb(KBD_ADDR);
-      kbd->keydown = false;
-      kbd->keycode = ps2_to_am_key(sc, true);
-    } else {
-      kbd->keydown = true;
-      kbd->keycode = ps2_to_am_key(next, true);
-    }
-  } else {
-    kbd->keydown = true;
-    kbd->keycode = ps2_to_am_key(kc, false);
+    kbd->keycode = AM_KEY_NONE;
+    return;
   }
+  *kbd = kbd_q[head % KBD_QLEN];
+  barrier();
+  kbd_head = head + 1;
 }
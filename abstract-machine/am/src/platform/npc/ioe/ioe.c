@@ -4,6 +4,8 @@
 void __am_timer_init();
 void __am_timer_rtc(AM_TIMER_RTC_T *);
 void __am_timer_uptime(AM_TIMER_UPTIME_T *);
+void __am_timer_cycles(AM_TIMER_CYCLES_T *);
+void __am_input_init();
 void __am_input_keybrd(AM_INPUT_KEYBRD_T *);
 
 void __am_gpu_config(AM_GPU_CONFIG_T *);
@@ -18,6 +20,9 @@ void __am_audio_play(AM_AUDIO_PLAY_T *);
 void __am_disk_config(AM_DISK_CONFIG_T *cfg);
 void __am_disk_status(AM_DISK_STATUS_T *stat);
 void __am_disk_blkio(AM_DISK_BLKIO_T *io);
+void __am_disk_flush(AM_DISK_FLUSH_T *flush);
+void __am_disk_submit(AM_DISK_SUBMIT_T *req);
+void __am_disk_reap(AM_DISK_REAP_T *reap);
 
 static void __am_timer_config(AM_TIMER_CONFIG_T *cfg) { cfg->present = true; cfg->has_rtc = true; }
 static void __am_input_config(AM_INPUT_CONFIG_T *cfg) { cfg->present = true;  }
@@ -29,6 +34,7 @@ static void *lut[128] = {
   [AM_TIMER_CONFIG] = __am_timer_config,
   [AM_TIMER_RTC   ] = __am_timer_rtc,
   [AM_TIMER_UPTIME] = __am_timer_uptime,
+  [AM_TIMER_CYCLES] = __am_timer_cycles,
   [AM_INPUT_CONFIG] = __am_input_config,
   [AM_INPUT_KEYBRD] = __am_input_keybrd,
   [AM_GPU_CONFIG  ] = __am_gpu_config,
@@ -42,6 +48,9 @@ static void *lut[128] = {
   [AM_DISK_CONFIG ] = __am_disk_config,
   [AM_DISK_STATUS ] = __am_disk_status,
   [AM_DISK_BLKIO  ] = __am_disk_blkio,
+  [AM_DISK_FLUSH  ] = __am_disk_flush,
+  [AM_DISK_SUBMIT ] = __am_disk_submit,
+  [AM_DISK_REAP   ] = __am_disk_reap,
   [AM_NET_CONFIG  ] = __am_net_config,
 };
 
@@ -53,6 +62,7 @@ bool ioe_init() {
   }
 
   __am_timer_init();
+  __am_input_init();
   return true;
 }
 
@@ -1,58 +1,52 @@
 #include <am.h>
 #include <npc.h>
 
-static uint64_t boot_time = 0;
-
-// Read CLINT mtime (64-bit cycle counter, split into two 32-bit MMIO reads)
-static inline uint64_t read_time_us() {
-  uint32_t hi, lo;
-  do {
-    hi = inl(RTC_ADDR + 4);
-    lo = inl(RTC_ADDR + 0);
-  } while (hi != inl(RTC_ADDR + 4));
-  uint64_t mtime = ((uint64_t)hi << 32) | lo;
-  return mtime;
-}
+uint64_t __am_boot_time = 0; // mtime at ioe_init(), uptime 0
 
 void __am_timer_init() {
-  boot_time = read_time_us();
+  __am_boot_time = __am_mtime();
 }
 
 void __am_timer_uptime(AM_TIMER_UPTIME_T *uptime) {
-  uptime->us = read_time_us() - boot_time;
+  uptime->us = __am_mtime() - __am_boot_time;
+}
+
+void __am_timer_cycles(AM_TIMER_CYCLES_T *cycles) {
+  cycles->cycles = __am_mcycle();
+}
+
+// days since 1970-01-01 -> proleptic Gregorian date, in constant time
+// (Howard Hinnant's civil_from_days, restricted to non-negative days)
+static void civil_from_days(uint32_t days, int *year, int *month, int *day) {
+  uint32_t z = days + 719468;   // shift the epoch to 0000-03-01
+  uint32_t era = z / 146097;    // 400-year eras
+  uint32_t doe = z - era * 146097;
+  uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  uint32_t mp  = (5 * doy + 2) / 153; // month starting from March
+  *day   = doy - (153 * mp + 2) / 5 + 1;
+  *month = (mp < 10 ? mp + 3 : mp - 9);
+  *year  = era * 400 + yoe + (*month <= 2);
 }
 
+// the date only changes once per day, so keep it around
+static uint64_t rtc_day_start = -1; // first second of the cached day
+static int rtc_year, rtc_month, rtc_day;
+
 void __am_timer_rtc(AM_TIMER_RTC_T *rtc) {
-  uint64_t secs = read_time_us() / 1000000;
-
-  rtc->second = secs % 60;
-  rtc->minute = (secs / 60) % 60;
-  rtc->hour   = (secs / 3600) % 24;
-
-  uint64_t days = secs / 86400;
-
-  // 1970-01-01 as epoch (UTC)
-  int year = 1970;
-  while (1) {
-    int leap = (year % 4 == 0 && year % 100 != 0) || (year % 400 == 0);
-    int ydays = leap ? 366 : 365;
-    if (days < (uint64_t)ydays) break;
-    days -= ydays;
-    year++;
-  }
+  uint64_t secs = __am_mtime() / 1000000;
 
-  static const int mdays_norm[12] = {31,28,31,30,31,30,31,31,30,31,30,31};
-  int month = 0;
-  while (1) {
-    int leap = (year % 4 == 0 && year % 100 != 0) || (year % 400 == 0);
-    int mdays = mdays_norm[month];
-    if (month == 1 && leap) mdays++;  // February in leap year
-    if (days < (uint64_t)mdays) break;
-    days -= mdays;
-    month++;
+  if (secs < rtc_day_start || secs - rtc_day_start >= 86400) {
+    uint32_t days = secs / 86400;
+    rtc_day_start = (uint64_t)days * 86400;
+    civil_from_days(days, &rtc_year, &rtc_month, &rtc_day);
   }
 
-  rtc->year  = year;
-  rtc->month = month + 1;
-  rtc->day   = (int)days + 1;
-}
\ No newline at end of file
+  uint32_t sod = secs - rtc_day_start; // second of the day
+  rtc->hour   = sod / 3600;
+  rtc->minute = sod / 60 % 60;
+  rtc->second = sod % 60;
+  rtc->year   = rtc_year;
+  rtc->month  = rtc_month;
+  rtc->day    = rtc_day;
+}
@@ -81,6 +81,9 @@ void putch(char ch) {
 // halt
 // ================================================================
 void halt(int code) {
+#ifdef UNALIGNED_PROF
+  __am_unaligned_dump();
+#endif
   ebreak(code);
 
   // should not reach here
@@ -0,0 +1,100 @@
+#include <am.h>
+#include <npc.h>
+#include <klib.h>
+
+// Multi-processor extension.
+//
+// All NR_CPU harts start at _start; the secondary ones get their own stack
+// and spin in fsbl_park() (fsbl.c) until mpe_init() writes MPE_MAGIC to
+// __am_mpe_release. They then take over the trap vector and address space
+// of hart 0 and call the same entry. Interrupts (the CLINT tick, PLIC
+// context 0) are only routed to hart 0; sleep_until() works on every hart
+// through its own mtimecmp.
+//
+// cpu_idle() parks the calling hart in wfi until another one calls
+// cpu_wake() on it, which raises its CLINT software interrupt. The
+// interrupt is only used as a wakeup and never taken: msip stays set
+// until the sleeper clears it, so a wakeup sent before the wfi is not
+// lost.
+
+#define MPE_MAGIC 0x4d50454d50454d50ull
+
+volatile uint64_t __am_mpe_release = 0;
+static void (*mpe_entry)() = NULL;
+static uintptr_t mpe_mtvec, mpe_satp;
+
+// harts given a stack by the linker script (--defsym=_nr_cpu); loaded
+// from data since the absolute symbol is out of reach of auipc
+extern char _nr_cpu[];
+static const uintptr_t nr_cpu_linked = (uintptr_t)_nr_cpu;
+
+void __am_mpe_secondary() {
+  asm volatile("csrw mtvec, %0" : : "r"(mpe_mtvec));
+  asm volatile("csrw satp, %0; sfence.vma" : : "r"(mpe_satp) : "memory");
+  asm volatile("csrw mscratch, zero");
+  mpe_entry();
+  panic("MPE entry returns");
+}
+
+bool mpe_init(void (*entry)()) {
+  // per-hart arrays in am and klib are sized by the compiled NR_CPU
+  panic_on(nr_cpu_linked != NR_CPU, "NR_CPU differs between compile and link, rebuild");
+  mpe_entry = entry;
+  asm volatile("csrr %0, mtvec" : "=r"(mpe_mtvec));
+  asm volatile("csrr %0, satp" : "=r"(mpe_satp));
+  // publish everything above before the harts can see the flag
+  asm volatile("fence rw, w" : : : "memory");
+  __am_mpe_release = MPE_MAGIC;
+
+  entry();
+  panic("MPE entry returns");
+}
+
+int cpu_count() {
+  return NR_CPU;
+}
+
+int cpu_current() {
+  uintptr_t hartid;
+  asm volatile("csrr %0, mhartid" : "=r"(hartid));
+  return hartid;
+}
+
+#define MIE_MSIE (1 << 3)
+
+void cpu_idle() {
+  uintptr_t msip = MSIP_ADDR(cpu_current());
+  bool en = ienabled();
+  if (en) iset(false);
+  asm volatile("csrs mie, %0" : : "r"(MIE_MSIE));
+  if (inl(msip) == 0) asm volatile("wfi");
+  outl(msip, 0);
+  asm volatile("csrc mie, %0" : : "r"(MIE_MSIE));
+  if (en) iset(true);
+}
+
+void cpu_wake(int cpu) {
+  asm volatile("fence w, o" : : : "memory"); // publish before the wakeup
+  outl(MSIP_ADDR(cpu), 1);
+}
+
+int atomic_xchg(int *addr, int newval) {
+#if NR_CPU > 1
+  int old;
+  uintptr_t fail;
+  asm volatile(
+    "1: lr.w.aqrl %0, (%2)\n"
+    "   sc.w.aqrl %1, %3, (%2)\n"
+    "   bnez %1, 1b"
+    : "=&r"(old), "=&r"(fail) : "r"(addr), "r"(newval) : "memory");
+  return old;
+#else
+  // one hart: masking interrupts makes the swap atomic, no A extension
+  bool en = ienabled();
+  iset(false);
+  int old = *(volatile int *)addr;
+  *(volatile int *)addr = newval;
+  if (en) iset(true);
+  return old;
+#endif
+}
@@ -0,0 +1,77 @@
+#include <am.h>
+#include <npc.h>
+
+// PLIC, as on QEMU virt. Only context 0 (hart 0, M-mode) is used.
+// A source either has an AM-internal handler (e.g. the keyboard) or is
+// reported to the user handler as EVENT_IRQ_IODEV with the source ID in
+// ev.cause.
+#define PLIC_PRIORITY(irq) (PLIC_BASE + 4 * (irq))
+#define PLIC_ENABLE(irq)   (PLIC_BASE + 0x2000 + (irq) / 32 * 4)
+#define PLIC_THRESHOLD     (PLIC_BASE + 0x200000)
+#define PLIC_CLAIM         (PLIC_BASE + 0x200004)
+
+#define PLIC_NR_IRQ 32
+#define MIE_MEIE    (1 << 11)
+
+static void (*handlers[PLIC_NR_IRQ])(void) = {};
+
+static inline void plic_check(int irq) {
+  panic_on(irq <= 0 || irq >= PLIC_NR_IRQ, "invalid PLIC source");
+}
+
+static void plic_set(int irq, int priority, bool enable) {
+  uint32_t bit = 1u << (irq % 32);
+  uint32_t en = inl(PLIC_ENABLE(irq));
+  outl(PLIC_PRIORITY(irq), priority);
+  outl(PLIC_ENABLE(irq), enable ? (en | bit) : (en & ~bit));
+  if (enable) {
+    outl(PLIC_THRESHOLD, 0);
+    asm volatile("csrs mie, %0" : : "r"(MIE_MEIE));
+  }
+}
+
+void __am_plic_enable(int irq, void (*handler)(void)) {
+  plic_check(irq);
+  handlers[irq] = handler;
+  plic_set(irq, 1, true);
+}
+
+void cte_irq_enable(int irq, int priority) {
+  plic_check(irq);
+  handlers[irq] = NULL;
+  plic_set(irq, priority, true);
+}
+
+void cte_irq_disable(int irq) {
+  plic_check(irq);
+  plic_set(irq, 0, false);
+  handlers[irq] = NULL;
+}
+
+// true if @irq reaches its AM-internal handler: the source is enabled in
+// the PLIC, external interrupts are enabled in mie and the handler is
+// installed. mstatus.MIE is up to the caller.
+bool __am_plic_enabled(int irq) {
+  plic_check(irq);
+  uintptr_t mie;
+  asm volatile("csrr %0, mie" : "=r"(mie));
+  return (mie & MIE_MEIE) && (inl(PLIC_ENABLE(irq)) & (1u << (irq % 32))) &&
+         handlers[irq] != NULL;
+}
+
+uint32_t __am_plic_claim() {
+  return inl(PLIC_CLAIM);
+}
+
+void __am_plic_complete(uint32_t irq) {
+  outl(PLIC_CLAIM, irq);
+}
+
+// run the AM-internal handler of @irq; false if the user should see it
+bool __am_plic_handle(uint32_t irq) {
+  if (irq < PLIC_NR_IRQ && handlers[irq] != NULL) {
+    handlers[irq]();
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,316 @@
+#include <am.h>
+#include <npc.h>
+#include <klib.h>
+
+// Sv39 paging.
+//
+// The kernel address space identity-maps SIM_PADDR_SPACE with the largest
+// pages that fit (1 GiB, 2 MiB, then 4 KiB), so the whole kernel takes a
+// handful of TLB entries. protect() copies its root table: user address
+// spaces share the kernel's lower-level tables and only own the tables
+// below USER_SPACE. M-mode itself is not translated; satp applies to
+// U-mode and to M-mode accesses made with MPRV.
+//
+// Each user address space gets an ASID, so switching satp does not flush
+// the TLB. ASIDs are handed out in generations: when they run out, the
+// generation is bumped, the whole TLB is flushed once and every address
+// space takes a fresh ASID the next time it is switched to. Kernel
+// mappings are global. Without ASID support in hardware (or once more
+// than ASID_TRACK address spaces exist) switches fall back to ASID 0 and
+// a full flush.
+
+#define PGSIZE     4096
+#define PGSHIFT    12
+#define PT_LEVELS  3
+#define PT_ENTRIES 512
+#define VPN(va, level) (((uintptr_t)(va) >> (PGSHIFT + 9 * (level))) & (PT_ENTRIES - 1))
+#define LEVEL_SIZE(level) ((uintptr_t)PGSIZE << (9 * (level)))
+
+#define PTE_PPN(pte)  (((pte) >> 10) << PGSHIFT)
+#define PTE_MAKE(pa, flags) ((((uintptr_t)(pa) >> PGSHIFT) << 10) | (flags))
+#define PTE_LEAF(pte) (((pte) & (PTE_R | PTE_W | PTE_X)) != 0)
+
+#define SATP_SV39    (8ull << 60)
+#define SATP_PPN     ((1ull << 44) - 1)
+#define SATP_ASID_SHIFT 44
+#define SATP_ASID    (0xffffull << SATP_ASID_SHIFT)
+
+#define ASID_TRACK   256 // address spaces that can hold an ASID, power of 2
+
+#define USER_SPACE RANGE(0x40000000, 0x80000000)
+
+typedef uintptr_t PTE;
+
+static AddrSpace kas = {};
+static void* (*pgalloc_usr)(int) = NULL;
+static void (*pgfree_usr)(void*) = NULL;
+static bool vme_enable = false;
+
+static Area segments[] = {      // Kernel memory mappings
+  SIM_PADDR_SPACE
+};
+
+// open-addressing table: root page table -> ASID and its generation
+static struct asid_slot {
+  uintptr_t root;
+  uint32_t gen;
+  uint32_t asid;
+} asid_tab[ASID_TRACK];
+static uint32_t asid_gen = 1;
+static uint32_t asid_next = 1; // ASID 0 is the kernel's and the fallback
+static uint32_t asid_max = 0;  // number of ASIDs, 0 if unsupported
+
+static inline uint32_t asid_hash(uintptr_t root) {
+  return ((uint32_t)(root >> PGSHIFT) * 2654435761u) & (ASID_TRACK - 1);
+}
+
+static struct asid_slot *asid_slot(uintptr_t root, bool create) {
+  uint32_t i = asid_hash(root);
+  for (int n = 0; n < ASID_TRACK; n++, i = (i + 1) & (ASID_TRACK - 1)) {
+    if (asid_tab[i].root == root) return &asid_tab[i];
+    if (asid_tab[i].root == 0) {
+      if (!create) return NULL;
+      asid_tab[i].root = root;
+      asid_tab[i].gen = 0;
+      return &asid_tab[i];
+    }
+  }
+  return NULL;
+}
+
+// delete with backward shift, so lookups never need tombstones
+static void asid_slot_remove(struct asid_slot *s) {
+  uint32_t i = s - asid_tab;
+  asid_tab[i].root = 0;
+  for (uint32_t j = (i + 1) & (ASID_TRACK - 1); asid_tab[j].root != 0; j = (j + 1) & (ASID_TRACK - 1)) {
+    uint32_t h = asid_hash(asid_tab[j].root);
+    if (((j - h) & (ASID_TRACK - 1)) >= ((j - i) & (ASID_TRACK - 1))) {
+      asid_tab[i] = asid_tab[j];
+      asid_tab[j].root = 0;
+      i = j;
+    }
+  }
+}
+
+// ASID for running on @root, allocating one if it has none in this
+// generation
+static uint32_t asid_get(void *root) {
+  if (asid_max == 0 || root == kas.ptr) return 0;
+  struct asid_slot *s = asid_slot((uintptr_t)root, true);
+  if (s == NULL) return 0;
+  if (s->gen != asid_gen) {
+    if (asid_next == asid_max) {
+      // rollover: no ASID of the old generation is trusted any more
+      asid_gen++;
+      asid_next = 1;
+      asm volatile("sfence.vma" : : : "memory");
+    }
+    s->asid = asid_next++;
+    s->gen = asid_gen;
+  }
+  return s->asid;
+}
+
+// Drop the translation of @va in @as after its leaf changed. An address
+// space with a stale ASID has nothing cached: the rollover flushed it.
+static void tlb_flush_page(AddrSpace *as, uintptr_t va) {
+  if (as == &kas) {
+    // the kernel tables are shared by every address space; map_kernel()
+    // leaves are global, but those added later through map(&kas, ...)
+    // are not, so any ASID may cache them: rs2 = x0 flushes all
+    asm volatile("sfence.vma %0, zero" : : "r"(va) : "memory");
+    return;
+  }
+  uintptr_t asid = 0; // untagged spaces run as ASID 0
+  if (asid_max != 0) {
+    struct asid_slot *s = asid_slot((uintptr_t)as->ptr, false);
+    if (s != NULL) {
+      if (s->gen != asid_gen) return;
+      asid = s->asid;
+    }
+  }
+  asm volatile("sfence.vma %0, %1" : : "r"(va), "r"(asid) : "memory");
+}
+
+static inline void set_satp(void *pdir) {
+  uintptr_t asid = asid_get(pdir);
+  uintptr_t satp = SATP_SV39 | (asid << SATP_ASID_SHIFT) | ((uintptr_t)pdir >> PGSHIFT);
+  asm volatile("csrw satp, %0" : : "r"(satp) : "memory");
+  if (asid == 0) {
+    // untagged: whatever is cached may belong to another address space
+    asm volatile("sfence.vma" : : : "memory");
+  }
+}
+
+// ASID bits are WARL: write all ones and see what sticks
+static void asid_probe() {
+  uintptr_t satp = SATP_SV39 | SATP_ASID;
+  asm volatile("csrw satp, %0; csrr %0, satp; csrw satp, zero" : "+r"(satp));
+  uint32_t mask = (satp & SATP_ASID) >> SATP_ASID_SHIFT;
+  asid_max = (mask != 0 ? mask + 1 : 0);
+}
+
+static inline uintptr_t get_satp() {
+  uintptr_t satp;
+  asm volatile("csrr %0, satp" : "=r"(satp));
+  return (satp & SATP_PPN) << PGSHIFT;
+}
+
+static PTE *pt_alloc() {
+  PTE *pt = pgalloc_usr(PGSIZE);
+  panic_on(pt == NULL, "out of memory for page tables");
+  memset(pt, 0, PGSIZE);
+  return pt;
+}
+
+// Find the PTE of @va at @level (0: 4 KiB, 1: 2 MiB, 2: 1 GiB). Missing
+// intermediate tables are created if @alloc, otherwise NULL is returned.
+static PTE *walk(AddrSpace *as, uintptr_t va, int level, bool alloc) {
+  PTE *pt = as->ptr;
+  for (int l = PT_LEVELS - 1; l > level; l--) {
+    PTE *pte = &pt[VPN(va, l)];
+    if (!(*pte & PTE_V)) {
+      if (!alloc) return NULL;
+      *pte = PTE_MAKE(pt_alloc(), PTE_V);
+    }
+    panic_on(PTE_LEAF(*pte), "mapping inside a superpage");
+    pt = (PTE *)PTE_PPN(*pte);
+  }
+  return &pt[VPN(va, level)];
+}
+
+static void map_leaf(AddrSpace *as, uintptr_t va, uintptr_t pa, int level, PTE flags) {
+  *walk(as, va, level, true) = PTE_MAKE(pa, flags);
+}
+
+// identity map [start, end) with superpages wherever the alignment allows
+static void map_kernel(uintptr_t start, uintptr_t end) {
+  PTE flags = PTE_V | PTE_R | PTE_W | PTE_X | PTE_G | PTE_A | PTE_D;
+  uintptr_t va = ROUNDDOWN(start, PGSIZE);
+  end = ROUNDUP(end, PGSIZE);
+  while (va < end) {
+    int level = PT_LEVELS - 1;
+    while (level > 0 && ((va & (LEVEL_SIZE(level) - 1)) != 0 || end - va < LEVEL_SIZE(level))) {
+      level--;
+    }
+    map_leaf(&kas, va, va, level, flags);
+    va += LEVEL_SIZE(level);
+  }
+}
+
+bool vme_init(void* (*pgalloc_f)(int), void (*pgfree_f)(void*)) {
+  pgalloc_usr = pgalloc_f;
+  pgfree_usr = pgfree_f;
+
+  asid_probe();
+
+  kas.pgsize = PGSIZE;
+  kas.ptr = pt_alloc();
+  for (int i = 0; i < LENGTH(segments); i++) {
+    map_kernel((uintptr_t)segments[i].start, (uintptr_t)segments[i].end);
+  }
+
+  set_satp(kas.ptr);
+  vme_enable = true;
+
+  return true;
+}
+
+void protect(AddrSpace *as) {
+  PTE *updir = pt_alloc();
+  as->pgsize = PGSIZE;
+  as->area = USER_SPACE;
+  as->ptr = updir;
+  // map kernel space
+  memcpy(updir, kas.ptr, PGSIZE);
+}
+
+// free the tables below @pt that are not shared with the kernel
+static void pt_free(PTE *pt, int level) {
+  for (int i = 0; i < PT_ENTRIES; i++) {
+    if ((pt[i] & PTE_V) && !PTE_LEAF(pt[i]) && level > 0) {
+      pt_free((PTE *)PTE_PPN(pt[i]), level - 1);
+    }
+  }
+  pgfree_usr(pt);
+}
+
+void unprotect(AddrSpace *as) {
+  PTE *updir = as->ptr, *kdir = kas.ptr;
+  if (updir == NULL || pgfree_usr == NULL) return;
+  // The root may come back from pgalloc for the next address space, and
+  // __am_switch() only compares roots: leave it, and drop everything
+  // cached for it, so nothing of this one survives into the next.
+  if (get_satp() == (uintptr_t)updir) set_satp(kas.ptr);
+  struct asid_slot *s = asid_slot((uintptr_t)updir, false);
+  if (s == NULL || asid_max == 0) {
+    asm volatile("sfence.vma" : : : "memory"); // it ran untagged, as ASID 0
+  } else {
+    if (s->gen == asid_gen) {
+      asm volatile("sfence.vma zero, %0" : : "r"((uintptr_t)s->asid) : "memory");
+    } // an older generation was flushed by the rollover
+    asid_slot_remove(s);
+  }
+
+  for (int i = 0; i < PT_ENTRIES; i++) {
+    if ((updir[i] & PTE_V) && !PTE_LEAF(updir[i]) && updir[i] != kdir[i]) {
+      pt_free((PTE *)PTE_PPN(updir[i]), PT_LEVELS - 2);
+    }
+  }
+  pgfree_usr(updir);
+  as->ptr = NULL;
+}
+
+// record the address space the trap came from in Context.pdir
+void __am_get_cur_as(Context *c) {
+  c->pdir = (vme_enable ? (void *)get_satp() : NULL);
+}
+
+// called on the way out of a trap: @c is the Context about to be resumed,
+// switch satp only if it lives in another address space
+void __am_switch(Context *c) {
+  if (vme_enable && c->pdir != NULL && (uintptr_t)c->pdir != get_satp()) {
+    set_satp(c->pdir);
+  }
+}
+
+// Map the page at @va to @pa, or change an existing mapping: a page can
+// be remapped elsewhere, or made read-only to share it copy-on-write.
+// MMAP_NONE removes the mapping so the next access faults. Only
+// MMAP_EXEC pages are executable (W^X is up to the caller); writable
+// pages are readable as well.
+void map(AddrSpace *as, void *va, void *pa, int prot) {
+  // outside its area the walk would reach the tables shared with kas
+  panic_on(as != &kas && !IN_RANGE(va, as->area), "map() outside the user area");
+  uintptr_t vpage = ROUNDDOWN(va, PGSIZE);
+  PTE *pte = walk(as, vpage, 0, prot != MMAP_NONE);
+  if (pte == NULL) return; // unmapping a page that was never mapped
+
+  PTE old = *pte;
+  if (prot == MMAP_NONE) {
+    *pte = 0;
+  } else {
+    PTE flags = PTE_V | PTE_A;
+    if (prot & (MMAP_READ | MMAP_WRITE)) flags |= PTE_R;
+    if (prot & MMAP_EXEC) flags |= PTE_X;
+    if (prot & MMAP_WRITE) flags |= PTE_W | PTE_D;
+    if (as != &kas) flags |= PTE_U;
+    *pte = PTE_MAKE(ROUNDDOWN(pa, PGSIZE), flags);
+  }
+  if (old & PTE_V) tlb_flush_page(as, vpage);
+}
+
+Context *ucontext(AddrSpace *as, Area kstack, void *entry) {
+  Context *c = (Context *)((uintptr_t)kstack.end - sizeof(Context));
+  for (int i = 0; i < NR_REGS; i++) {
+    c->gpr[i] = 0;
+  }
+  c->mepc = (uintptr_t)entry;
+  c->mstatus = 0x80; // MPP = 0 (U-mode), MPIE = 1
+  c->mcause = 0;
+  // trap.S resumes U-mode on gpr[2] and keeps the kernel stack in
+  // mscratch; the caller sets up the user stack
+  c->gpr[2] = 0;
+  c->pdir = as->ptr;
+  return c;
+}
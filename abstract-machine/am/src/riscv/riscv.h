@@ -16,6 +16,7 @@ static inline void outl(uintptr_t addr, uint32_t data) { *(volatile uint32_t *)a
 #define PTE_W 0x04
 #define PTE_X 0x08
 #define PTE_U 0x10
+#define PTE_G 0x20
 #define PTE_A 0x40
 #define PTE_D 0x80
 
@@ -0,0 +1,89 @@
+#include <am.h>
+#include <klib.h>
+#include <klib-macros.h>
+#include <klib-task.h>
+
+// Parallel Mandelbrot on the work-stealing runtime. The image is split
+// into tiles recursively; the same work runs with 1..cpu_count() worker
+// harts and the speedup over one hart is reported.
+//
+//   make ARCH=riscv64-npc NR_CPU=4 run
+
+#define W      256
+#define H      192
+#define TILE   16
+#define ITER   128
+#define FRAC   24 // Q8.24 fixed point, there is no FPU
+
+static uint8_t image[H][W];
+
+typedef struct {
+  int x0, y0, x1, y1;
+} tile_t;
+
+static int mandel(int64_t cr, int64_t ci) {
+  int64_t zr = 0, zi = 0;
+  int i;
+  for (i = 0; i < ITER; i++) {
+    int64_t zr2 = (zr * zr) >> FRAC, zi2 = (zi * zi) >> FRAC;
+    if (zr2 + zi2 > (4ll << FRAC)) break;
+    zi = ((zr * zi) >> (FRAC - 1)) + ci;
+    zr = zr2 - zi2 + cr;
+  }
+  return i;
+}
+
+static void render(void *arg) {
+  tile_t *t = arg;
+  int w = t->x1 - t->x0, h = t->y1 - t->y0;
+  if (w > TILE || h > TILE) {
+    // split the longer side and render both halves in parallel
+    tile_t a = *t, b = *t;
+    if (w >= h) a.x1 = b.x0 = t->x0 + w / 2;
+    else        a.y1 = b.y0 = t->y0 + h / 2;
+    task_group_t g = TASK_GROUP_INIT;
+    task_spawn(&g, render, &a);
+    render(&b);
+    task_sync(&g);
+    return;
+  }
+  for (int y = t->y0; y < t->y1; y++) {
+    for (int x = t->x0; x < t->x1; x++) {
+      // x in [-2, 1), y in [-1.125, 1.125)
+      int64_t cr = -(2ll << FRAC) + ((3ll << FRAC) / W) * x;
+      int64_t ci = -(9ll << (FRAC - 3)) + ((9ll << (FRAC - 2)) / H) * y;
+      image[y][x] = mandel(cr, ci);
+    }
+  }
+}
+
+static uint32_t checksum() {
+  uint32_t h = 0x811c9dc5;
+  for (int y = 0; y < H; y++) {
+    for (int x = 0; x < W; x++) h = (h ^ image[y][x]) * 0x01000193;
+  }
+  return h;
+}
+
+static void bench(void *arg) {
+  uint64_t base = 0;
+  uint32_t ref = 0;
+  for (int n = 1; n <= cpu_count(); n++) {
+    task_set_workers(n);
+    tile_t all = { 0, 0, W, H };
+    uint64_t t0 = io_read(AM_TIMER_UPTIME).us;
+    render(&all);
+    uint64_t us = io_read(AM_TIMER_UPTIME).us - t0;
+    uint32_t sum = checksum();
+    if (n == 1) { base = us; ref = sum; }
+    uint64_t x100 = (us ? base * 100 / us : 0);
+    printf("harts %d: %d us, speedup %d.%02d, checksum %x%s\n", n, (int)us,
+        (int)(x100 / 100), (int)(x100 % 100), sum, sum == ref ? "" : " MISMATCH");
+    assert(sum == ref);
+  }
+}
+
+int main(const char *args) {
+  ioe_init();
+  task_start(bench, NULL);
+}
@@ -0,0 +1,153 @@
+#ifndef KLIB_SYNC_H__
+#define KLIB_SYNC_H__
+
+#include <am.h>
+
+// Synchronization primitives.
+//
+// KLIB_SMP is set when the program runs on several harts (NR_CPU > 1 on
+// NPC); then locks spin and counters use atomic instructions. Otherwise
+// the only concurrency is an interrupt on the same hart: spin_lock() is
+// free, the _irqsave variants just mask interrupts, and counters are
+// updated with interrupts masked, so no A extension is needed.
+
+#if defined(NR_CPU) && NR_CPU > 1
+#define KLIB_SMP 1
+#else
+#define KLIB_SMP 0
+#endif
+
+#ifndef barrier
+#define barrier() asm volatile("" : : : "memory")
+#endif
+
+#if KLIB_SMP
+#define smp_mb()  __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define smp_rmb() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define smp_wmb() __atomic_thread_fence(__ATOMIC_RELEASE)
+#else
+#define smp_mb()  barrier()
+#define smp_rmb() barrier()
+#define smp_wmb() barrier()
+#endif
+
+// ticket lock: FIFO among the waiting harts
+typedef struct {
+  volatile uint32_t next, owner;
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0, 0 }
+
+static inline void spin_init(spinlock_t *l) {
+  l->next = l->owner = 0;
+}
+
+static inline void spin_lock(spinlock_t *l) {
+#if KLIB_SMP
+  uint32_t me = __atomic_fetch_add(&l->next, 1, __ATOMIC_RELAXED);
+  while (__atomic_load_n(&l->owner, __ATOMIC_ACQUIRE) != me) ;
+#else
+  barrier();
+#endif
+}
+
+static inline bool spin_trylock(spinlock_t *l) {
+#if KLIB_SMP
+  uint32_t owner = __atomic_load_n(&l->owner, __ATOMIC_RELAXED);
+  uint32_t next = owner;
+  return __atomic_compare_exchange_n(&l->next, &next, owner + 1, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+#else
+  barrier();
+  return true;
+#endif
+}
+
+static inline void spin_unlock(spinlock_t *l) {
+#if KLIB_SMP
+  __atomic_store_n(&l->owner, l->owner + 1, __ATOMIC_RELEASE);
+#else
+  barrier();
+#endif
+}
+
+// for data shared with interrupt handlers; returns the interrupt state
+// to hand back to spin_unlock_irqrestore()
+static inline bool spin_lock_irqsave(spinlock_t *l) {
+  bool en = ienabled();
+  if (en) iset(false);
+  spin_lock(l);
+  return en;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t *l, bool en) {
+  spin_unlock(l);
+  if (en) iset(true);
+}
+
+// atomic counter
+typedef struct {
+  volatile long v;
+} atomic_t;
+
+#define ATOMIC_INIT(x) { (x) }
+
+static inline long atomic_read(atomic_t *a) {
+  return a->v;
+}
+
+static inline void atomic_set(atomic_t *a, long v) {
+  a->v = v;
+}
+
+// add @d and return the old value
+static inline long atomic_add(atomic_t *a, long d) {
+#if KLIB_SMP
+  return __atomic_fetch_add(&a->v, d, __ATOMIC_SEQ_CST);
+#else
+  bool en = ienabled();
+  if (en) iset(false);
+  long old = a->v;
+  a->v = old + d;
+  if (en) iset(true);
+  return old;
+#endif
+}
+
+// set to @val if it is @old; true on success
+static inline bool atomic_cas(atomic_t *a, long old, long val) {
+#if KLIB_SMP
+  return __atomic_compare_exchange_n(&a->v, &old, val, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+#else
+  bool en = ienabled();
+  if (en) iset(false);
+  bool ok = (a->v == old);
+  if (ok) a->v = val;
+  if (en) iset(true);
+  return ok;
+#endif
+}
+
+#define atomic_inc(a) atomic_add(a, 1)
+#define atomic_dec(a) atomic_add(a, -1)
+
+// Single-producer single-consumer ring of @nr_slots (a power of 2)
+// elements of @esize bytes. No lock: one side may be an interrupt
+// handler or another hart. The producer only writes tail, the consumer
+// only writes head.
+typedef struct {
+  volatile uint32_t head, tail; // free running
+  uint32_t mask, esize;
+  uint8_t *buf;
+} spsc_t;
+
+void spsc_init(spsc_t *q, void *buf, uint32_t nr_slots, uint32_t esize);
+bool spsc_push(spsc_t *q, const void *elem); // false if full
+bool spsc_pop (spsc_t *q, void *elem);       // false if empty
+
+static inline uint32_t spsc_count(spsc_t *q) {
+  return q->tail - q->head;
+}
+
+#endif
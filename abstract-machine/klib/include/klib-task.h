@@ -0,0 +1,32 @@
+#ifndef KLIB_TASK_H__
+#define KLIB_TASK_H__
+
+#include <am.h>
+#include <klib-sync.h>
+
+// Work-stealing task runtime on top of MPE.
+//
+//   task_start(root, arg)       run root(arg) on hart 0 with every hart
+//                               as a worker; halt(0) when it returns
+//   task_spawn(&g, fn, arg)     queue fn(arg) as part of group g
+//   task_sync(&g)               wait until every task of g has finished
+//
+// Each hart owns a Chase-Lev deque: spawned tasks go to its bottom, the
+// owner takes them back LIFO and idle harts steal from the top. A task
+// group only counts its pending tasks, so tasks may spawn and sync their
+// own groups to any depth.
+
+typedef struct {
+  atomic_t pending;
+} task_group_t;
+
+#define TASK_GROUP_INIT { ATOMIC_INIT(0) }
+
+void task_start(void (*root)(void *), void *arg) __attribute__((__noreturn__));
+void task_set_workers(int n); // harts taking tasks, 1..cpu_count()
+int  task_workers(void);
+void task_group_init(task_group_t *g);
+void task_spawn(task_group_t *g, void (*fn)(void *), void *arg);
+void task_sync(task_group_t *g);
+
+#endif
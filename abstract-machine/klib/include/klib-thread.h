@@ -0,0 +1,30 @@
+#ifndef KLIB_THREAD_H__
+#define KLIB_THREAD_H__
+
+#include <am.h>
+
+// Cooperative threads on kcontext() and yield().
+//
+// thread_init() installs the scheduler as the CTE handler and turns the
+// caller into the first thread. Threads switch only in thread_yield(),
+// thread_sleep(), thread_join() and thread_exit(). The highest priority
+// ready thread runs next (0 is the highest), round robin among equals;
+// picking it is O(1) whatever the number of threads. Every thread must
+// be joined, which returns its stack to the pool.
+
+#define THREAD_NR_PRIO      32
+#define THREAD_PRIO_DEFAULT 16
+#define THREAD_STACK_SIZE   (16 * 1024)
+
+typedef struct thread thread_t;
+
+// @chain gets every event the scheduler does not consume, may be NULL
+void      thread_init  (Context *(*chain)(Event ev, Context *ctx));
+thread_t *thread_create(void (*fn)(void *), void *arg, int prio);
+void      thread_exit  (void) __attribute__((__noreturn__));
+void      thread_join  (thread_t *t);
+void      thread_yield (void);
+void      thread_sleep (uint64_t us);
+thread_t *thread_self  (void);
+
+#endif
@@ -41,6 +41,10 @@ int    snprintf  (char *str, size_t size, const char *format, ...);
 int    vsprintf  (char *str, const char *format, va_list ap);
 int    vsnprintf (char *str, size_t size, const char *format, va_list ap);
 
+// romfs (tools/mkromfs.py), mounted from the ramdisk by default
+bool   romfs_mount (Area image);
+Area   romfs_lookup(const char *path);
+
 // assert.h
 #ifdef NDEBUG
   #define assert(ignore) ((void)0)
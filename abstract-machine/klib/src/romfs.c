@@ -0,0 +1,68 @@
+#include <am.h>
+#include <klib.h>
+#include <klib-macros.h>
+#include <stdint.h>
+
+#if !defined(__ISA_NATIVE__) || defined(__NATIVE_USE_KLIB__)
+
+// Read-only file system packed by tools/mkromfs.py. Lookups hash the path
+// and return an Area pointing straight into the image, nothing is copied.
+
+#define ROMFS_MAGIC 0x53464f52 // "ROFS"
+#define ROMFS_NONE  0xffffffffu
+
+typedef struct {
+  uint32_t magic, version, nr_files, nr_buckets;
+  uint32_t bucket[];
+} romfs_hdr_t;
+
+typedef struct {
+  uint32_t hash, next, name_off, reserved;
+  uint64_t data_off, size;
+} romfs_entry_t;
+
+// the ramdisk on platforms that have one
+extern char _ramdisk_start[] __attribute__((weak));
+extern char _ramdisk_end[] __attribute__((weak));
+
+static const romfs_hdr_t *romfs = NULL;
+static const romfs_entry_t *romfs_entries = NULL;
+static bool romfs_probed = false;
+
+bool romfs_mount(Area image) {
+  const romfs_hdr_t *h = image.start;
+  romfs = NULL;
+  romfs_probed = true;
+  if (h == NULL || (uintptr_t)image.end - (uintptr_t)image.start < sizeof(*h) ||
+      h->magic != ROMFS_MAGIC) {
+    return false;
+  }
+  romfs = h;
+  romfs_entries = (const romfs_entry_t *)&h->bucket[h->nr_buckets];
+  return true;
+}
+
+static uint32_t fnv1a(const char *s) {
+  uint32_t h = 0x811c9dc5;
+  for (; *s; s++) h = (h ^ (uint8_t)*s) * 0x01000193;
+  return h;
+}
+
+Area romfs_lookup(const char *path) {
+  if (!romfs_probed) romfs_mount(RANGE(_ramdisk_start, _ramdisk_end));
+  if (romfs == NULL) return RANGE(NULL, NULL);
+
+  while (*path == '/') path++;
+  uint32_t hash = fnv1a(path);
+  uint32_t i = romfs->bucket[hash & (romfs->nr_buckets - 1)];
+  for (; i != ROMFS_NONE; i = romfs_entries[i].next) {
+    const romfs_entry_t *e = &romfs_entries[i];
+    if (e->hash == hash && strcmp((const char *)romfs + e->name_off, path) == 0) {
+      const char *data = (const char *)romfs + e->data_off;
+      return RANGE(data, data + e->size);
+    }
+  }
+  return RANGE(NULL, NULL);
+}
+
+#endif
@@ -1,6 +1,7 @@
 #include <am.h>
 #include <klib.h>
 #include <klib-macros.h>
+#include <klib-sync.h>
 #include <stdarg.h>
 #include <limits.h>
 
@@ -69,10 +70,21 @@ int snprintf(char *buffer, size_t buf_size, const char *format, ...) {
    In the kernel, the console is both the video display and first
    serial port.
    In userspace, the console is file descriptor 1. */
+#if KLIB_SMP
+// keeps lines of different harts from interleaving
+static spinlock_t console_lock = SPINLOCK_INIT;
+#endif
+
 int printf(const char *format, ...) {
   va_list args;
   va_start(args, format);
+#if KLIB_SMP
+  bool irq = spin_lock_irqsave(&console_lock);
+#endif
   int retval = vprintf(format, args);
+#if KLIB_SMP
+  spin_unlock_irqrestore(&console_lock, irq);
+#endif
   va_end(args);
 
   return retval;
@@ -1,6 +1,7 @@
 #include <am.h>
 #include <klib-macros.h>
 #include <klib.h>
+#include <klib-sync.h>
 
 #if !defined(__ISA_NATIVE__) || defined(__NATIVE_USE_KLIB__)
 static unsigned long int next = 1;
@@ -37,25 +38,165 @@ extern Area heap;
 
 static char * hbrk = 0;
 static uintptr_t mlim = 0;
+#if KLIB_SMP
+static spinlock_t heap_lock = SPINLOCK_INIT;
+#endif
 
 static void malloc_init() {
   hbrk = (void *)ROUNDUP(heap.start, 8);
   mlim = (uintptr_t)ROUNDDOWN(heap.end, 8) - (uintptr_t)hbrk;
 }
 
-void* malloc(size_t size) {
+static void bzero8(void *ptr, size_t size) {
+  for (uint64_t *p = ptr; p != (uint64_t *)((char *)ptr + size); p ++) { *p = 0; }
+}
+
+// bump allocation from the shared heap, size is a multiple of 8
+static void *heap_alloc(size_t size) {
+#if KLIB_SMP
+  bool irq = spin_lock_irqsave(&heap_lock);
+#endif
   if (hbrk == 0) malloc_init();
-  size  = (size_t)ROUNDUP(size, 8);
   char *old = hbrk;
   hbrk += size;
-  assert((uintptr_t)heap.start <= (uintptr_t)hbrk && (uintptr_t)hbrk < (uintptr_t)heap.end);
-  for (uint64_t *p = (uint64_t *)old; p != (uint64_t *)hbrk; p ++) { *p = 0; } // bzero
-  assert((uintptr_t)hbrk - (uintptr_t)heap.start <= mlim);
+  char *end = hbrk;
+#if KLIB_SMP
+  spin_unlock_irqrestore(&heap_lock, irq);
+#endif
+  assert((uintptr_t)heap.start <= (uintptr_t)end && (uintptr_t)end < (uintptr_t)heap.end);
+  assert((uintptr_t)end - (uintptr_t)heap.start <= mlim);
   return old;
 }
 
+#if KLIB_SMP
+
+// Per-hart caches. Small blocks come from per-hart free lists of a few
+// size classes, so malloc() and free() on the owning hart never touch a
+// lock. An empty list is refilled with a batch of blocks carved from
+// the shared heap under heap_lock. A block freed by another hart goes on
+// the owner's lock-free remote list, which the owner takes over in one
+// swap the next time one of its lists runs dry. Blocks larger than the
+// biggest class come from the shared heap and are never reused, like
+// every block of the single-hart allocator.
+
+#define NR_CLASS     8  // 16, 32, ..., 2048 bytes
+#define CLASS_MIN    16
+#define CLASS_LARGE  0xffff
+#define REFILL_BYTES 4096
+
+// precedes every block; keeps the block 8-byte aligned
+typedef struct {
+  uint16_t owner, cls;
+  uint32_t size;
+} mhdr_t;
+
+typedef struct mfree {
+  struct mfree *next;
+} mfree_t;
+
+static struct hcache {
+  mfree_t *list[NR_CLASS];
+  mfree_t *remote; // pushed by other harts
+} __attribute__((aligned(64))) hcache[NR_CPU];
+
+static inline int size_class(size_t size) {
+  int c = 0;
+  while ((CLASS_MIN << c) < size) c++;
+  return c;
+}
+
+static inline size_t class_size(int c) {
+  return (size_t)CLASS_MIN << c;
+}
+
+// move the blocks other harts have freed back to their class lists
+static void drain_remote(struct hcache *hc) {
+  mfree_t *b = __atomic_exchange_n(&hc->remote, NULL, __ATOMIC_ACQUIRE);
+  while (b != NULL) {
+    mfree_t *next = b->next;
+    int c = ((mhdr_t *)b - 1)->cls;
+    b->next = hc->list[c];
+    hc->list[c] = b;
+    b = next;
+  }
+}
+
+static void refill(struct hcache *hc, int c, int owner) {
+  size_t bsize = sizeof(mhdr_t) + class_size(c);
+  int n = REFILL_BYTES / bsize;
+  if (n < 1) n = 1;
+  char *p = heap_alloc(bsize * n);
+  for (int i = 0; i < n; i++, p += bsize) {
+    mhdr_t *h = (mhdr_t *)p;
+    h->owner = owner;
+    h->cls = c;
+    h->size = class_size(c);
+    mfree_t *b = (mfree_t *)(h + 1);
+    b->next = hc->list[c];
+    hc->list[c] = b;
+  }
+}
+
+void* malloc(size_t size) {
+  size  = (size_t)ROUNDUP(size, 8);
+  if (size > class_size(NR_CLASS - 1)) {
+    mhdr_t *h = heap_alloc(sizeof(mhdr_t) + size);
+    h->owner = cpu_current();
+    h->cls = CLASS_LARGE;
+    h->size = size;
+    bzero8(h + 1, size);
+    return h + 1;
+  }
+
+  int c = size_class(size);
+  // an interrupt handler on this hart may allocate as well
+  bool irq = ienabled();
+  if (irq) iset(false);
+  int me = cpu_current();
+  struct hcache *hc = &hcache[me];
+  if (hc->list[c] == NULL) drain_remote(hc);
+  if (hc->list[c] == NULL) refill(hc, c, me);
+  mfree_t *b = hc->list[c];
+  hc->list[c] = b->next;
+  if (irq) iset(true);
+
+  bzero8(b, class_size(c));
+  return b;
+}
+
+void free(void *ptr) {
+  if (ptr == NULL) return;
+  mhdr_t *h = (mhdr_t *)ptr - 1;
+  if (h->cls == CLASS_LARGE) return;
+
+  mfree_t *b = ptr;
+  bool irq = ienabled();
+  if (irq) iset(false);
+  if (h->owner == cpu_current()) {
+    b->next = hcache[h->owner].list[h->cls];
+    hcache[h->owner].list[h->cls] = b;
+  } else {
+    mfree_t **remote = &hcache[h->owner].remote;
+    b->next = __atomic_load_n(remote, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(remote, &b->next, b, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) ;
+  }
+  if (irq) iset(true);
+}
+
+#else
+
+void* malloc(size_t size) {
+  size  = (size_t)ROUNDUP(size, 8);
+  void *p = heap_alloc(size);
+  bzero8(p, size);
+  return p;
+}
+
 void free(void *ptr) { }
 
+#endif
+
 #else
 
 void *malloc(size_t size) { return NULL; }
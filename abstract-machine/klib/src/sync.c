@@ -0,0 +1,33 @@
+#include <am.h>
+#include <klib.h>
+#include <klib-sync.h>
+
+#if !defined(__ISA_NATIVE__) || defined(__NATIVE_USE_KLIB__)
+
+void spsc_init(spsc_t *q, void *buf, uint32_t nr_slots, uint32_t esize) {
+  q->head = q->tail = 0;
+  q->mask = nr_slots - 1;
+  q->esize = esize;
+  q->buf = buf;
+}
+
+bool spsc_push(spsc_t *q, const void *elem) {
+  uint32_t tail = q->tail;
+  if (tail - q->head > q->mask) return false;
+  memcpy(q->buf + (tail & q->mask) * q->esize, elem, q->esize);
+  smp_wmb(); // the element is in place before the consumer can see it
+  q->tail = tail + 1;
+  return true;
+}
+
+bool spsc_pop(spsc_t *q, void *elem) {
+  uint32_t head = q->head;
+  if (head == q->tail) return false;
+  smp_rmb(); // read the element only after seeing the new tail
+  memcpy(elem, q->buf + (head & q->mask) * q->esize, q->esize);
+  smp_mb();  // done reading before the producer may reuse the slot
+  q->head = head + 1;
+  return true;
+}
+
+#endif
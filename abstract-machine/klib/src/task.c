@@ -0,0 +1,194 @@
+#include <am.h>
+#include <klib.h>
+#include <klib-macros.h>
+#include <klib-sync.h>
+#include <klib-task.h>
+
+#if !defined(__ISA_NATIVE__) || defined(__NATIVE_USE_KLIB__)
+
+// Tasks run to completion on the stack of the hart that picked them.
+// task_sync() does not block: while its group is pending it keeps
+// popping and stealing other tasks, so the hart stays busy and no task
+// needs a stack or a Context of its own. A hart with nothing to steal
+// parks with cpu_idle(); task_spawn() wakes one parked hart, if any.
+
+#ifndef NR_CPU
+#define NR_CPU 1
+#endif
+
+#define DEQUE_SIZE 256 // per hart, power of 2
+
+typedef struct {
+  void (*fn)(void *);
+  void *arg;
+  task_group_t *g;
+} task_t;
+
+static struct deque {
+  atomic_t top;    // next task to steal
+  atomic_t bottom; // next free slot, owner only
+  task_t buf[DEQUE_SIZE];
+} __attribute__((aligned(64))) deques[NR_CPU];
+
+static volatile int sleeping[NR_CPU];
+static atomic_t nr_sleeping = ATOMIC_INIT(0);
+static volatile int nr_workers = 1;
+
+static void (*root_fn)(void *) = NULL;
+static void *root_arg = NULL;
+
+// owner: false if the deque is full
+static bool deque_push(struct deque *d, task_t *t) {
+  long b = atomic_read(&d->bottom);
+  long top = atomic_read(&d->top);
+  if (b - top >= DEQUE_SIZE) return false;
+  d->buf[b & (DEQUE_SIZE - 1)] = *t;
+  smp_wmb();
+  atomic_set(&d->bottom, b + 1);
+  return true;
+}
+
+// owner: take the newest task
+static bool deque_pop(struct deque *d, task_t *t) {
+  long b = atomic_read(&d->bottom) - 1;
+  atomic_set(&d->bottom, b);
+  smp_mb();
+  long top = atomic_read(&d->top);
+  if (top > b) { // empty
+    atomic_set(&d->bottom, b + 1);
+    return false;
+  }
+  *t = d->buf[b & (DEQUE_SIZE - 1)];
+  bool ok = true;
+  if (top == b) { // the last one: race the thieves for it
+    ok = atomic_cas(&d->top, top, top + 1);
+    atomic_set(&d->bottom, b + 1);
+  }
+  return ok;
+}
+
+// any hart: take the oldest task
+static bool deque_steal(struct deque *d, task_t *t) {
+  long top = atomic_read(&d->top);
+  smp_mb();
+  long b = atomic_read(&d->bottom);
+  if (top >= b) return false;
+  *t = d->buf[top & (DEQUE_SIZE - 1)];
+  return atomic_cas(&d->top, top, top + 1);
+}
+
+static void run(task_t *t) {
+  t->fn(t->arg);
+  smp_wmb(); // results are visible before the group sees the task done
+  atomic_dec(&t->g->pending);
+}
+
+// Run one task from our own deque or stolen from another worker. A hart
+// beyond nr_workers only drains what is left in its own deque.
+static bool run_one(int me) {
+  task_t t;
+  if (deque_pop(&deques[me], &t)) {
+    run(&t);
+    return true;
+  }
+  int n = nr_workers;
+  if (me >= n) return false;
+  for (int i = 1; i < n; i++) {
+    int victim = (me + i) % n;
+    if (deque_steal(&deques[victim], &t)) {
+      run(&t);
+      return true;
+    }
+  }
+  return false;
+}
+
+static inline bool deque_empty(struct deque *d) {
+  return atomic_read(&d->bottom) <= atomic_read(&d->top);
+}
+
+static bool has_work(int me) {
+  if (me >= nr_workers) return !deque_empty(&deques[me]);
+  for (int i = 0; i < nr_workers; i++) {
+    if (!deque_empty(&deques[i])) return true;
+  }
+  return false;
+}
+
+static void park(int me) {
+  sleeping[me] = 1;
+  atomic_inc(&nr_sleeping);
+  smp_mb(); // pairs with the one in wake_one()
+  if (!has_work(me)) cpu_idle();
+  sleeping[me] = 0;
+  atomic_dec(&nr_sleeping);
+}
+
+static void wake_one(int me) {
+  smp_mb();
+  if (atomic_read(&nr_sleeping) == 0) return;
+  for (int i = 0; i < nr_workers; i++) {
+    if (i != me && sleeping[i]) {
+      cpu_wake(i);
+      return;
+    }
+  }
+}
+
+static void worker() {
+  int me = cpu_current();
+  if (me == 0) {
+    root_fn(root_arg);
+    halt(0);
+  }
+  while (1) {
+    if (!run_one(me)) park(me);
+  }
+}
+
+void task_start(void (*root)(void *), void *arg) {
+  root_fn = root;
+  root_arg = arg;
+  nr_workers = cpu_count();
+  mpe_init(worker);
+  panic("mpe_init returns");
+}
+
+void task_set_workers(int n) {
+  if (n < 1) n = 1;
+  if (n > cpu_count()) n = cpu_count();
+  nr_workers = n;
+  smp_mb();
+  for (int i = 1; i < n; i++) {
+    if (sleeping[i]) cpu_wake(i);
+  }
+}
+
+int task_workers() {
+  return nr_workers;
+}
+
+void task_group_init(task_group_t *g) {
+  atomic_set(&g->pending, 0);
+}
+
+void task_spawn(task_group_t *g, void (*fn)(void *), void *arg) {
+  int me = cpu_current();
+  task_t t = { .fn = fn, .arg = arg, .g = g };
+  atomic_inc(&g->pending);
+  if (!deque_push(&deques[me], &t)) {
+    run(&t); // deque full: no point in queueing more
+    return;
+  }
+  wake_one(me);
+}
+
+void task_sync(task_group_t *g) {
+  int me = cpu_current();
+  while (atomic_read(&g->pending) > 0) {
+    run_one(me);
+  }
+  smp_rmb(); // see the results of the finished tasks
+}
+
+#endif
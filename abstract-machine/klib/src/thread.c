@@ -0,0 +1,166 @@
+#include <am.h>
+#include <klib.h>
+#include <klib-macros.h>
+#include <klib-thread.h>
+
+#if !defined(__ISA_NATIVE__) || defined(__NATIVE_USE_KLIB__)
+
+// One FIFO per priority plus a bitmap of the non-empty ones: the next
+// thread is the head of the queue of the lowest set bit. Sleeping threads
+// wait in a list sorted by deadline; with nothing ready the scheduler
+// parks the hart with sleep_until() until the first one is due. A thread
+// and its stack are one block from a pool, so creating threads does not
+// keep growing the heap.
+
+enum { T_RUNNING, T_READY, T_SLEEPING, T_BLOCKED, T_DEAD };
+
+struct thread {
+  Context *ctx;
+  int state, prio;
+  thread_t *next;   // run queue, sleep list or stack pool
+  thread_t *joiner; // waiting in thread_join()
+  uint64_t wake_at; // uptime in us
+  void (*fn)(void *);
+  void *arg;
+};
+
+static struct {
+  thread_t *head, *tail;
+} rq[THREAD_NR_PRIO];
+static uint32_t rq_bitmap = 0;
+
+static thread_t *sleepers = NULL;
+static thread_t *pool = NULL;
+static thread_t main_thread;
+static thread_t *current = NULL;
+static Context *(*chain_handler)(Event, Context *) = NULL;
+
+// index of the lowest set bit of @x != 0, without a ctz instruction
+static inline int lowest_bit(uint32_t x) {
+  static const uint8_t debruijn[32] = {
+    0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+    31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9,
+  };
+  return debruijn[((x & -x) * 0x077cb531u) >> 27];
+}
+
+static void rq_push(thread_t *t) {
+  t->state = T_READY;
+  t->next = NULL;
+  if (rq[t->prio].tail) rq[t->prio].tail->next = t;
+  else rq[t->prio].head = t;
+  rq[t->prio].tail = t;
+  rq_bitmap |= 1u << t->prio;
+}
+
+static thread_t *rq_pop() {
+  if (rq_bitmap == 0) return NULL;
+  int p = lowest_bit(rq_bitmap);
+  thread_t *t = rq[p].head;
+  rq[p].head = t->next;
+  if (rq[p].head == NULL) {
+    rq[p].tail = NULL;
+    rq_bitmap &= ~(1u << p);
+  }
+  return t;
+}
+
+static void wake_sleepers(uint64_t now) {
+  while (sleepers != NULL && sleepers->wake_at <= now) {
+    thread_t *t = sleepers;
+    sleepers = t->next;
+    rq_push(t);
+  }
+}
+
+static Context *schedule(Event ev, Context *c) {
+  if (ev.event != EVENT_YIELD) {
+    return (chain_handler ? chain_handler(ev, c) : c);
+  }
+
+  current->ctx = c;
+  if (current->state == T_RUNNING) rq_push(current);
+  wake_sleepers(io_read(AM_TIMER_UPTIME).us);
+
+  thread_t *next;
+  while ((next = rq_pop()) == NULL) {
+    panic_on(sleepers == NULL, "all threads are blocked");
+    sleep_until(sleepers->wake_at);
+    wake_sleepers(io_read(AM_TIMER_UPTIME).us);
+  }
+  next->state = T_RUNNING;
+  current = next;
+  return next->ctx;
+}
+
+void thread_init(Context *(*chain)(Event, Context *)) {
+  chain_handler = chain;
+  main_thread.state = T_RUNNING;
+  main_thread.prio = THREAD_PRIO_DEFAULT;
+  current = &main_thread;
+  cte_init(schedule);
+}
+
+static void thread_entry(void *arg) {
+  thread_t *t = arg;
+  t->fn(t->arg);
+  thread_exit();
+}
+
+thread_t *thread_create(void (*fn)(void *), void *arg, int prio) {
+  assert(prio >= 0 && prio < THREAD_NR_PRIO);
+  thread_t *t = pool;
+  if (t != NULL) pool = t->next;
+  else t = malloc(THREAD_STACK_SIZE);
+  assert(t != NULL);
+
+  Area kstack = RANGE(ROUNDUP(t + 1, 16), ROUNDDOWN((uintptr_t)t + THREAD_STACK_SIZE, 16));
+  t->ctx = kcontext(kstack, thread_entry, t);
+  t->prio = prio;
+  t->joiner = NULL;
+  t->fn = fn;
+  t->arg = arg;
+  rq_push(t);
+  return t;
+}
+
+void thread_exit() {
+  thread_t *t = current;
+  t->state = T_DEAD;
+  if (t->joiner) rq_push(t->joiner);
+  yield();
+  panic("dead thread scheduled");
+}
+
+void thread_join(thread_t *t) {
+  assert(t != current && t != &main_thread && t->joiner == NULL);
+  t->joiner = current;
+  while (t->state != T_DEAD) {
+    current->state = T_BLOCKED;
+    yield();
+  }
+  // it has switched away for good, its stack is free
+  t->next = pool;
+  pool = t;
+}
+
+void thread_yield() {
+  yield();
+}
+
+void thread_sleep(uint64_t us) {
+  thread_t *t = current;
+  t->wake_at = io_read(AM_TIMER_UPTIME).us + us;
+  thread_t **p = &sleepers;
+  while (*p != NULL && (*p)->wake_at <= t->wake_at) p = &(*p)->next;
+  t->next = *p;
+  *p = t;
+  t->state = T_SLEEPING;
+  yield();
+}
+
+thread_t *thread_self() {
+  return current;
+}
+
+#endif
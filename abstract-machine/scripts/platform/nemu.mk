@@ -9,6 +9,8 @@ AM_SRCS += platform/npc/ioe/ioe.c \
            platform/npc/ioe/gpu.c \
            platform/npc/ioe/audio.c \
            platform/npc/ioe/disk.c \
+           platform/npc/ioe/bcache.c \
+           platform/npc/ioe/diskq.c \
            platform/npc/ioe/trm.c
 
 CFLAGS    += -fdata-sections -ffunction-sections
@@ -22,11 +24,79 @@ CFLAGS += -DFLASH_BASE=$(FLASH_BASE) -DFLASH_SIZE=$(FLASH_SIZE)
 CFLAGS += -DSDRAM_BASE=$(SDRAM_BASE) -DSDRAM_SIZE=$(SDRAM_SIZE)
 CFLAGS += -DCLINT_BASE=$(CLINT_BASE) -DCLINT_SIZE=$(CLINT_SIZE)
 CFLAGS += -DPLIC_BASE=$(PLIC_BASE) -DPLIC_SIZE=$(PLIC_SIZE)
+CFLAGS += -DMTIME_READ_$(shell echo $(MTIME_READ) | tr a-z A-Z)
+CFLAGS += -DMTVEC_VECTORED=$(MTVEC_VECTORED)
+CFLAGS += -DNR_CPU=$(NR_CPU)
+CFLAGS += -DKBD_IRQ=$(KBD_IRQ)
 
 LDSCRIPTS += $(AM_HOME)/scripts/npc-linker.ld
 LDFLAGS   += --defsym=_flash_base=$(FLASH_BASE) --defsym=_flash_size=$(FLASH_SIZE)
 LDFLAGS   += --defsym=_sdram_base=$(SDRAM_BASE) --defsym=_sdram_size=$(SDRAM_SIZE)
+LDFLAGS   += --defsym=_nr_cpu=$(NR_CPU)
 LDFLAGS   += --gc-sections -e _start
+
+# ramdisk 留在 flash 中按块换入 SDRAM; RAMDISK_CACHE=0 时直接读 flash (只读)
+# 压缩盘 (ZDISK) 按 chunk 解压, 用不到 SDRAM 影子
+ifdef ZDISK
+RAMDISK_CACHE := 0
+endif
+RAMDISK_CACHE ?= 1
+CFLAGS    += -DRAMDISK_CACHE=$(RAMDISK_CACHE)
+LDFLAGS   += --defsym=_ramdisk_cache_en=$(RAMDISK_CACHE)
+
+# AM_DISK_BLKIO 前的 LRU 块缓存 (块数, 0 表示关闭); 有 SDRAM 影子时默认关闭
+DISK_BCACHE ?= $(if $(filter 0,$(RAMDISK_CACHE)),64,0)
+CFLAGS    += -DDISK_BCACHE=$(DISK_BCACHE)
+
+# UNALIGNED_PROF=1: 统计被模拟的非对齐访存 (按 PC), halt() 时输出,
+# 用 tools/unaligned-sym.py 结合 ELF 符号化
+ifdef UNALIGNED_PROF
+CFLAGS    += -DUNALIGNED_PROF
+endif
+
+# ROMFS=<dir>: 用 tools/mkromfs.py 打包目录, 作为 ramdisk 链接进镜像
+ifdef ROMFS
+ROMFS_IMG := $(DST_DIR)/romfs.img
+ROMFS_OBJ := $(DST_DIR)/romfs.o
+LINKAGE   += $(ROMFS_OBJ)
+
+$(ROMFS_IMG): $(shell find $(ROMFS) -type f 2>/dev/null)
+	@echo + ROMFS $(ROMFS) "->" $(shell realpath $@ --relative-to .)
+	@python3 $(AM_HOME)/tools/mkromfs.py $(ROMFS) $@
+
+$(ROMFS_OBJ): $(ROMFS_IMG)
+	@printf '.section .ramdisk, "a"\n.incbin "%s"\n' $< > $(ROMFS_OBJ:.o=.S)
+	@$(AS) $(COMMON_CFLAGS) -c -o $@ $(ROMFS_OBJ:.o=.S)
+endif
+
+# ZDISK=<img>: 用 tools/mkzdisk.py 分块压缩磁盘镜像, 作为 ramdisk 链接进镜像 (只读)
+ifdef ZDISK
+ifdef ROMFS
+$(error ROMFS and ZDISK both provide the ramdisk)
+endif
+ZDISK_SHIFT ?= 3
+ZDISK_IMG   := $(DST_DIR)/zdisk.img
+ZDISK_OBJ   := $(DST_DIR)/zdisk.o
+LINKAGE     += $(ZDISK_OBJ)
+
+$(ZDISK_IMG): $(ZDISK)
+	@echo + ZDISK $(ZDISK) "->" $(shell realpath $@ --relative-to .)
+	@python3 $(AM_HOME)/tools/mkzdisk.py $(ZDISK) $@ $(ZDISK_SHIFT)
+
+$(ZDISK_OBJ): $(ZDISK_IMG)
+	@printf '.section .ramdisk, "a"\n.incbin "%s"\n' $< > $(ZDISK_OBJ:.o=.S)
+	@$(AS) $(COMMON_CFLAGS) -c -o $@ $(ZDISK_OBJ:.o=.S)
+endif
+
+# 决定编译结果的配置 (hart 数, -march, 数组大小, 条件编译); 与上次构建不同时
+# 重写 stamp, 使 DST_DIR 下的目标文件全部重编. am/klib 由递归 make 构建, 各有一份
+NPC_CONFIG       := NR_CPU=$(NR_CPU) RAMDISK_CACHE=$(RAMDISK_CACHE) DISK_BCACHE=$(DISK_BCACHE) \
+                    MTIME_READ=$(MTIME_READ) MTVEC_VECTORED=$(MTVEC_VECTORED) UNALIGNED_PROF=$(UNALIGNED_PROF) KBD_IRQ=$(KBD_IRQ)
+NPC_CONFIG_STAMP := $(DST_DIR)/.npc-config
+ifneq ($(NPC_CONFIG),$(shell cat $(NPC_CONFIG_STAMP) 2>/dev/null))
+$(shell echo '$(NPC_CONFIG)' > $(NPC_CONFIG_STAMP))
+endif
+$(OBJS): $(NPC_CONFIG_STAMP)
 LDFLAGS   += --orphan-handling=warn
 
 MAINARGS_MAX_LEN = 64
@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+
+# Pack a directory into a read-only romfs image for klib's romfs_lookup().
+#
+#   python3 $(AM_HOME)/tools/mkromfs.py <dir> <output>
+#
+# `make ROMFS=<dir>` does this automatically and links the image as the
+# ramdisk. Files are stored uncompressed and 8-byte aligned, so romfs_lookup()
+# can hand out pointers straight into the image.
+#
+# Layout (little endian, all offsets from the start of the image):
+#   u32 magic ("ROFS"), u32 version, u32 nr_files, u32 nr_buckets,
+#   u32 bucket[nr_buckets]      first entry of each hash chain, or ~0
+#   entry[nr_files]             u32 hash, u32 next, u32 name_off, u32 reserved,
+#                               u64 data_off, u64 size
+#   names                       NUL-terminated paths relative to <dir>
+#   data
+# The hash is 32-bit FNV-1a over the path; bucket = hash & (nr_buckets - 1).
+
+import os
+import struct
+from sys import argv
+
+MAGIC = 0x53464f52  # "ROFS"
+VERSION = 1
+NONE = 0xffffffff
+HDR = struct.Struct('<IIII')
+ENTRY = struct.Struct('<IIIIQQ')
+
+
+def fnv1a(s):
+    h = 0x811c9dc5
+    for b in s:
+        h = ((h ^ b) * 0x01000193) & 0xffffffff
+    return h
+
+
+def align(n, a):
+    return (n + a - 1) // a * a
+
+
+def main():
+    if len(argv) != 3:
+        print("Usage: mkromfs.py <dir> <output>")
+        exit(1)
+    root = argv[1]
+
+    files = []
+    for dirpath, dirnames, filenames in os.walk(root):
+        dirnames.sort()
+        for name in sorted(filenames):
+            path = os.path.join(dirpath, name)
+            files.append((os.path.relpath(path, root).replace(os.sep, '/').encode(), path))
+
+    nr_buckets = 2  # keeps the entry table 8-byte aligned
+    while nr_buckets < len(files):
+        nr_buckets *= 2
+
+    names_off = HDR.size + 4 * nr_buckets + ENTRY.size * len(files)
+    names = bytearray()
+    name_offs = []
+    for name, _ in files:
+        name_offs.append(names_off + len(names))
+        names += name + b'\0'
+
+    data_off = align(names_off + len(names), 8)
+    data = bytearray()
+    bucket = [NONE] * nr_buckets
+    entries = []
+    for i, (name, path) in enumerate(files):
+        content = open(path, 'rb').read()
+        h = fnv1a(name)
+        b = h & (nr_buckets - 1)
+        entries.append([h, bucket[b], name_offs[i], 0, data_off + len(data), len(content)])
+        bucket[b] = i
+        data += content
+        data += bytes(align(len(data), 8) - len(data))
+
+    with open(argv[2], 'wb') as fp:
+        fp.write(HDR.pack(MAGIC, VERSION, len(files), nr_buckets))
+        fp.write(struct.pack('<{0}I'.format(nr_buckets), *bucket))
+        for e in entries:
+            fp.write(ENTRY.pack(*e))
+        fp.write(names)
+        fp.write(bytes(data_off - names_off - len(names)))
+        fp.write(data)
+
+    print("romfs: {0} files, {1} bytes".format(len(files), data_off + len(data)))
+
+
+if __name__ == '__main__':
+    main()
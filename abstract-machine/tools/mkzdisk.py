@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+
+# Build a block-compressed ramdisk image for the NPC platform.
+#
+#   python3 $(AM_HOME)/tools/mkzdisk.py disk.img disk.zimg [chunk_shift]
+#
+# `make ZDISK=disk.img [ZDISK_SHIFT=n]` runs this and links the result
+# into `.ramdisk`; am/src/platform/npc/ioe/disk.c recognizes the header and
+# decompresses chunks on demand. ZDISK also implies RAMDISK_CACHE=0, so no
+# SDRAM shadow is reserved; pass it yourself when linking an image by hand.
+#
+# Layout (little endian):
+#   u32 magic ("ZDSK"), u16 version, u16 chunk_shift,
+#   u32 blksz, u32 nr_blks, u32 nr_chunks, u32 reserved,
+#   u32 index[nr_chunks + 1]   offset of each chunk in the data area,
+#   data                       LZ4 block format, or raw when that is
+#                              not smaller than the chunk itself.
+# A chunk holds (1 << chunk_shift) blocks of blksz bytes.
+
+import struct
+from sys import argv
+
+BLKSZ = 512
+MAGIC = 0x4b53445a  # "ZDSK"
+VERSION = 1
+MAX_CHUNK_SHIFT = 4  # must match ZCHUNK_MAX in disk.c
+
+MIN_MATCH = 4
+LAST_LITERALS = 5
+MF_LIMIT = 12
+
+
+def write_len(out, n):
+    while n >= 255:
+        out.append(255)
+        n -= 255
+    out.append(n)
+
+
+def emit(out, literals, offset=0, mlen=0):
+    ll = len(literals)
+    ml = mlen - MIN_MATCH if offset else 0
+    out.append((min(ll, 15) << 4) | (min(ml, 15) if offset else 0))
+    if ll >= 15:
+        write_len(out, ll - 15)
+    out += literals
+    if offset:
+        out += struct.pack('<H', offset)
+        if ml >= 15:
+            write_len(out, ml - 15)
+
+
+def lz4_compress(src):
+    n = len(src)
+    out = bytearray()
+    table = {}
+    anchor = i = 0
+    while i < n - MF_LIMIT:
+        key = src[i:i + MIN_MATCH]
+        cand = table.get(key)
+        table[key] = i
+        if cand is None or i - cand > 0xffff:
+            i += 1
+            continue
+        m = MIN_MATCH
+        while i + m < n - LAST_LITERALS and src[cand + m] == src[i + m]:
+            m += 1
+        emit(out, src[anchor:i], i - cand, m)
+        i += m
+        anchor = i
+    emit(out, src[anchor:])
+    return bytes(out)
+
+
+def main():
+    if len(argv) < 3:
+        print("Usage: mkzdisk.py <raw image> <output> [chunk_shift]")
+        exit(1)
+    chunk_shift = int(argv[3]) if len(argv) > 3 else 3
+    if not 0 <= chunk_shift <= MAX_CHUNK_SHIFT:
+        print("Error: chunk_shift should be in [0, {0}]".format(MAX_CHUNK_SHIFT))
+        exit(1)
+
+    raw = open(argv[1], 'rb').read()
+    chunk_size = BLKSZ << chunk_shift
+    nr_blks = (len(raw) + BLKSZ - 1) // BLKSZ
+    nr_chunks = (len(raw) + chunk_size - 1) // chunk_size
+    raw += bytes(nr_chunks * chunk_size - len(raw))
+
+    index, data = [], bytearray()
+    for c in range(nr_chunks):
+        chunk = raw[c * chunk_size:(c + 1) * chunk_size]
+        z = lz4_compress(chunk)
+        index.append(len(data))
+        data += z if len(z) < chunk_size else chunk
+    index.append(len(data))
+
+    hdr = struct.pack('<IHHIIII', MAGIC, VERSION, chunk_shift, BLKSZ, nr_blks, nr_chunks, 0)
+    with open(argv[2], 'wb') as fp:
+        fp.write(hdr)
+        fp.write(struct.pack('<{0}I'.format(len(index)), *index))
+        fp.write(data)
+
+    total = len(hdr) + 4 * len(index) + len(data)
+    print("zdisk: {0} -> {1} bytes ({2:.1f}%)".format(len(raw), total, 100.0 * total / max(len(raw), 1)))
+
+
+if __name__ == '__main__':
+    main()
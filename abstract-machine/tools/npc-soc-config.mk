@@ -6,3 +6,15 @@ CLINT_BASE := 0x02000000
 CLINT_SIZE := 0x10000
 PLIC_BASE  := 0x0c000000
 PLIC_SIZE  := 0x400000
+
+# CLINT mtime 的读法: mmio32 (高/低两次 32 位读), mmio64 (一次 ld), csr (rdtime)
+MTIME_READ := mmio64
+
+# PS/2 键盘控制器接在 PLIC 的哪个中断源上 (由 SoC 的中断连线决定, 须与仿真器一致)
+KBD_IRQ := 2
+
+# hart 数 (mhartid 0..NR_CPU-1); 大于 1 时需要 A 扩展 (LR/SC)
+NR_CPU := 1
+
+# mtvec 向量模式: 定时器/外部中断直接跳到各自的入口 (不支持时自动回退直接模式)
+MTVEC_VECTORED := 1
@@ -0,0 +1,47 @@
+#!/usr/bin/env python3
+
+# Symbolize the misaligned-access profile printed by halt() when AM is
+# built with UNALIGNED_PROF=1.
+#
+#   make run UNALIGNED_PROF=1 | python3 $(AM_HOME)/tools/unaligned-sym.py build/app-riscv64-npc.elf
+#   python3 $(AM_HOME)/tools/unaligned-sym.py build/app-riscv64-npc.elf npc-output.txt
+#
+# addr2line is taken from $ADDR2LINE, or $CROSS_COMPILE-addr2line.
+
+import os
+import re
+import subprocess
+import sys
+
+LINE = re.compile(r'\[unaligned\] pc=(0x[0-9a-fA-F]+) loads=(\d+) stores=(\d+) bytes=(\d+)')
+
+
+def main():
+    if len(sys.argv) < 2:
+        print("Usage: unaligned-sym.py <elf> [log]")
+        exit(1)
+    elf = sys.argv[1]
+    log = open(sys.argv[2]) if len(sys.argv) > 2 else sys.stdin
+
+    rows = []
+    for line in log:
+        m = LINE.search(line)
+        if m:
+            rows.append((m.group(1), int(m.group(2)), int(m.group(3)), int(m.group(4))))
+        elif '[unaligned]' in line:
+            print(line.rstrip())
+    if not rows:
+        return
+
+    addr2line = os.environ.get('ADDR2LINE', os.environ.get('CROSS_COMPILE', '') + 'addr2line')
+    out = subprocess.run([addr2line, '-f', '-C', '-e', elf] + [r[0] for r in rows],
+                         capture_output=True, text=True, check=True).stdout.splitlines()
+
+    print("{0:>18} {1:>10} {2:>10} {3:>12}  {4}".format('pc', 'loads', 'stores', 'bytes', 'location'))
+    for i, (pc, loads, stores, nbytes) in enumerate(rows):
+        func, src = out[2 * i], out[2 * i + 1]
+        print("{0:>18} {1:>10} {2:>10} {3:>12}  {4} ({5})".format(pc, loads, stores, nbytes, func, src))
+
+
+if __name__ == '__main__':
+    main()